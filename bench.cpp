@@ -0,0 +1,789 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "byte_source.h"
+#include "commands.h"
+#include "common.h"
+#include "decompress.h"
+#include "events.h"
+#include "game_index.h"
+#include "games.h"
+#include "headers.h"
+#include "mapped_file.h"
+#include "move_tree.h"
+#include "parser.h"
+#include "read_ahead.h"
+#include "replay.h"
+#include "scanner.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// throughput of the lexer alone, since big concatenated inputs are not necessarily valid games
+template <class F>
+void measure(const std::string& name, size_t bytes, F&& scan, const char* unit = "tokens")
+{
+  auto start = std::chrono::steady_clock::now();
+  size_t count = scan();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << count << " " << unit << ", " << bytes << " bytes in " << elapsed.count()
+            << "s, " << (bytes / 1e6) / elapsed.count() << " MB/s\n";
+}
+
+size_t count_tokens(TokenScanner& scanner)
+{
+  size_t tokens = 0;
+  for (const auto& token : scanner)
+  {
+    (void)token;
+    ++tokens;
+  }
+  return tokens;
+}
+
+// tells results from moves and nothing else, so the parser overhead is not buried in SAN decoding
+struct TrivialMoveHandler
+{
+  Moves operator()(std::string_view symbol, bool) const
+  {
+    if (symbol == "1-0" || symbol == "0-1" || symbol == "1/2-1/2")
+      return Finish{};
+    return Ignore{};
+  }
+};
+
+// how moves used to be emitted: a heap allocated std::function called through a pointer
+template <class Handler>
+struct FunctionMoveHandler
+{
+  std::unique_ptr<std::function<Moves(std::string_view, bool)>> emit =
+    std::make_unique<std::function<Moves(std::string_view, bool)>>(Handler{});
+
+  Moves operator()(std::string_view symbol, bool white_turn) const
+  {
+    return (*emit)(symbol, white_turn);
+  }
+};
+
+// tags only, with the movetext jumped over or merely lexed, against the full replay
+int bench_headers(const std::string& input_file)
+{
+  MappedFile mapping(input_file);
+  measure("headers, movetext skipped", mapping.size(),
+          [&]
+          {
+            size_t games = 0;
+            scan_headers(mapping.data(), mapping.data() + mapping.size(),
+                         [&](const GameHeaders&) { ++games; });
+            return games;
+          },
+          "games");
+
+  // what --tags WhiteElo:int,BlackElo:int,ECO,TimeControl asks for, the rest is never decoded
+  const auto columns = parse_tag_projection("WhiteElo:int,BlackElo:int,ECO,TimeControl");
+  measure("headers, 4 tags projected", mapping.size(),
+          [&]
+          {
+            size_t games = 0;
+            std::ostringstream out;
+            std::string scratch;
+            scan_headers(mapping.data(), mapping.data() + mapping.size(),
+                         [&](const GameHeaders& headers)
+                         {
+                           ++games;
+                           for (const TagColumn& column : columns)
+                             write_tag(out, headers, column, scratch);
+                         });
+            return games;
+          },
+          "games");
+
+  measure("headers, movetext lexed", mapping.size(),
+          [&]
+          {
+            size_t games = 0;
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            scan_headers(scanner, [&](const GameHeaders&) { ++games; });
+            return games;
+          },
+          "games");
+
+  measure("full replay", mapping.size(),
+          [&]
+          {
+            size_t games = 0;
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            replay_games(scanner, 0, [&](const GameRecord&, const ChessBoard&) { ++games; });
+            return games;
+          },
+          "games");
+  return 0;
+}
+
+// per move cost of the parser alone, over tokens scanned up front
+struct MoveCounter
+{
+  size_t moves = 0;
+  size_t count = 0;
+  void on_move(std::string_view, bool, unsigned depth)
+  {
+    moves += depth == 0;
+    ++count;
+  }
+};
+
+struct EventCounter
+{
+  size_t moves = 0;
+  size_t count = 0;
+  void on_tag(std::string_view, std::string_view) { ++count; }
+  void on_move(std::string_view, bool, unsigned depth)
+  {
+    moves += depth == 0;
+    ++count;
+  }
+  void on_comment(std::string_view) { ++count; }
+  void on_nag(unsigned) { ++count; }
+  void on_variation_begin() { ++count; }
+  void on_variation_end() { ++count; }
+  void on_result(TerminationMarker) { ++count; }
+};
+
+// variations replayed from their branch point with the board journal, against copying the board
+// for every variation, and the main line alone for reference; trees are built with and without
+// the annotations of their moves
+int bench_rav(const std::string& input_file)
+{
+  MappedFile mapping(input_file);
+  measure("main line replay", mapping.size(),
+          [&]
+          {
+            size_t plies = 0;
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            replay_games(scanner, 0, [&](const GameRecord& record, const ChessBoard&)
+                         { plies += record.plies; });
+            return plies;
+          },
+          "main line moves");
+
+  MoveTree tree;
+  measure("move trees built", mapping.size(),
+          [&]
+          {
+            size_t moves = 0;
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            read_move_trees(scanner, 0, tree,
+                            [&](const GameRecord&, const MoveTree& game) { moves += game.size(); });
+            return moves;
+          },
+          "moves");
+
+  measure("move trees built, comments and NAGs kept", mapping.size(),
+          [&]
+          {
+            size_t annotations = 0;
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            read_move_trees<true>(scanner, 0, tree, [&](const GameRecord&, const MoveTree& game)
+                                  { annotations += game.annotation_count(); });
+            return annotations;
+          },
+          "annotations");
+
+  measure("move trees replayed, journal", mapping.size(),
+          [&]
+          {
+            size_t moves = 0;
+            ChessBoard board;
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            read_move_trees(scanner, 0, tree,
+                            [&](const GameRecord&, const MoveTree& game)
+                            {
+                              board.reset();
+                              replay_tree(game, board, [&](auto&&...) { ++moves; });
+                            });
+            return moves;
+          },
+          "moves");
+
+  measure("move trees replayed, board copies", mapping.size(),
+          [&]
+          {
+            size_t moves = 0;
+            const MoveFactory decode;
+            auto play = [&](auto& self, const MoveTree& game, uint32_t first, ChessBoard& board)
+              -> void
+            {
+              for (uint32_t node = first; node != MoveNode::NONE; node = game[node].next)
+              {
+                const MoveNode& move = game[node];
+                for (uint32_t line = move.variation; line != MoveNode::NONE;
+                     line = game[line].sibling)
+                {
+                  ChessBoard copy = board;
+                  self(self, game, line, copy);
+                }
+                board.apply(decode(game.san(move), move.white));
+                ++moves;
+              }
+            };
+            ChessBoard board;
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            read_move_trees(scanner, 0, tree,
+                            [&](const GameRecord&, const MoveTree& game)
+                            {
+                              board.reset();
+                              play(play, game, game.root(), board);
+                            });
+            return moves;
+          },
+          "moves");
+  return 0;
+}
+
+int bench_parser(const std::string& input_file)
+{
+  MappedFile mapping(input_file);
+  TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+  std::vector<Token> tokens;
+  for (const auto& token : scanner)
+    tokens.push_back(token);
+
+  auto run = [&]<class Handler>(const std::string& name, Handler)
+  {
+    BasicPGNParser<Handler> parser;
+    size_t moves = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Token& token : tokens)
+    {
+      auto action = parser.consume_token(token, scanner.text(token));
+      if (!action)
+        continue;
+      if (std::holds_alternative<Finish>(*action))
+        parser.reset();
+      else
+        ++moves;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << moves << " moves, " << tokens.size() << " tokens, "
+              << elapsed.count() / std::max<size_t>(moves, 1) << " ns/move\n";
+  };
+
+  run("std::function, results only", FunctionMoveHandler<TrivialMoveHandler>{});
+  run("inline, results only", TrivialMoveHandler{});
+  run("std::function, MoveFactory", FunctionMoveHandler<MoveFactory>{});
+  run("inline, MoveFactory", MoveFactory{});
+  run("inline, MoveFactory keeping tokens", TokenKeepingMoveFactory{});
+
+  // the SAN of every main line move decoded into a packed move alone, from scratch and through
+  // the cache
+  std::vector<std::pair<std::string_view, bool>> sans;
+  {
+    BasicPGNParser<ResultOnlyMoves> parser;
+    struct Collect
+    {
+      std::vector<std::pair<std::string_view, bool>>& sans;
+      void on_move(std::string_view san, bool white, unsigned depth)
+      {
+        if (depth == 0)
+          sans.emplace_back(san, white);
+      }
+    } collect{sans};
+    for (const Token& token : tokens)
+    {
+      auto action = parser.consume_token(token, scanner.text(token), collect);
+      if (action && std::holds_alternative<Finish>(*action))
+        parser.reset();
+    }
+  }
+  auto run_decode = [&](const std::string& name, auto&& decode)
+  {
+    uint32_t bits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& [san, white] : sans)
+      bits ^= decode(san, white).bits();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    volatile uint32_t keep = bits; // or the decoding is optimized away
+    (void)keep;
+    std::cout << name << ": " << sans.size() << " moves, "
+              << elapsed.count() / std::max<size_t>(sans.size(), 1) << " ns/move\n";
+  };
+  run_decode("SAN decoded, MoveFactory", PackingMoveFactory());
+  CachingMoveFactory cache;
+  run_decode("SAN decoded, CachingMoveFactory", cache);
+  std::cout << "SAN cache: " << cache.lookups() << " lookups, " << cache.hit_rate() * 100
+            << "% hits\n";
+
+  // the event API with a handler that only counts moves and one that takes every callback
+  auto run_events = [&](const std::string& name, auto events)
+  {
+    BasicPGNParser<ResultOnlyMoves> parser;
+    auto start = std::chrono::steady_clock::now();
+    for (const Token& token : tokens)
+    {
+      auto action = parser.consume_token(token, scanner.text(token), events);
+      if (action && std::holds_alternative<Finish>(*action))
+        parser.reset();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << events.moves << " moves, " << events.count << " events, "
+              << elapsed.count() / std::max<size_t>(events.moves, 1) << " ns/move\n";
+  };
+  run_events("events, on_move only", MoveCounter{});
+  run_events("events, every callback", EventCounter{});
+
+  // per ply %clk, %emt and %eval columns, decoded from the comment bytes and with the regex a
+  // post-processing script would run on every comment
+  struct RegexCommands : PlyCommands
+  {
+    std::regex command{R"(\[%(clk|emt|eval) ([^\]]*)\])"};
+    void on_comment(std::string_view text)
+    {
+      if (clock.empty())
+        return;
+      std::cmatch match;
+      for (const char* p = text.data();
+           std::regex_search(p, text.data() + text.size(), match, command);
+           p = match[0].second)
+      {
+        const std::string argument = match[2].str();
+        int32_t& value = match[1] == "clk" ? clock.back()
+                         : match[1] == "emt" ? elapsed.back()
+                                             : eval.back();
+        value = match[1] == "eval" ? static_cast<int32_t>(std::stod(argument) * 100)
+                                   : static_cast<int32_t>(argument.size());
+      }
+    }
+  };
+  auto run_commands = [&](const std::string& name, auto commands)
+  {
+    BasicPGNParser<ResultOnlyMoves> parser;
+    size_t moves = 0;
+    size_t clocks = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Token& token : tokens)
+    {
+      auto action = parser.consume_token(token, scanner.text(token), commands);
+      if (action && std::holds_alternative<Finish>(*action))
+      {
+        moves += commands.plies();
+        clocks += std::count_if(commands.clock.begin(), commands.clock.end(),
+                                [](int32_t clock) { return clock != MoveCommands::NONE; });
+        commands.clear();
+        parser.reset();
+      }
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << moves << " moves, " << clocks << " clocks, "
+              << elapsed.count() / std::max<size_t>(moves, 1) << " ns/move\n";
+  };
+  run_commands("events, commands decoded", PlyCommands{});
+  run_commands("events, commands by std::regex", RegexCommands{});
+  return 0;
+}
+
+// whole games replayed sequentially and split across threads, which have to agree game by game
+int bench_replay(const std::string& input_file, size_t threads)
+{
+  MappedFile mapping(input_file);
+  auto summarize = [](const GameRecord& record, const ChessBoard&) { return record; };
+  auto same = [](const GameRecord& a, const GameRecord& b)
+  { return a.offset == b.offset && a.plies == b.plies && a.result == b.result; };
+
+  std::vector<GameRecord> sequential;
+  CachingMoveFactory sequential_decode;
+  measure("sequential replay", mapping.size(),
+          [&]
+          {
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            NoEvents none;
+            replay_games(
+              scanner, 0, [&](const GameRecord& record, const ChessBoard& board)
+              { sequential.push_back(summarize(record, board)); }, none, &sequential_decode);
+            return sequential.size();
+          },
+          "games");
+  std::cout << "SAN cache of the sequential replay: " << sequential_decode.lookups()
+            << " lookups, " << sequential_decode.hit_rate() * 100 << "% hits\n";
+
+  std::vector<GameRecord> parallel;
+  measure("parallel replay x" + std::to_string(threads), mapping.size(),
+          [&]
+          {
+            parallel = replay_games_parallel(mapping.data(), mapping.data() + mapping.size(),
+                                             threads, summarize);
+            return parallel.size();
+          },
+          "games");
+
+  // the same games pulled one move at a time through the generators
+  std::vector<GameRecord> pulled;
+  measure("pgn_games replay", mapping.size(),
+          [&]
+          {
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            ChessBoard board;
+            for (PgnGame& game : pgn_games(scanner))
+            {
+              GameRecord record{game.offset(), 0, TerminationMarker::MANUAL};
+              board.reset();
+              for (const PgnMove& move : game.moves())
+              {
+                board.apply(move.move);
+                ++record.plies;
+              }
+              if (!game.finished())
+                break;
+              record.result = game.result();
+              pulled.push_back(record);
+            }
+            return pulled.size();
+          },
+          "games");
+
+  // parsed into flat arrays of 4 byte moves first, then played from them
+  std::vector<GameRecord> packed;
+  std::vector<PackedMove> played;
+  CachingMoveFactory decode;
+  measure("packed replay", mapping.size(),
+          [&]
+          {
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            ChessBoard board;
+            decode = CachingMoveFactory();
+            read_packed_games(scanner, 0, decode,
+                              [&](const GameRecord& record, std::span<const PackedSan> moves)
+                              {
+                                board.reset();
+                                played.clear();
+                                replay_packed(moves, board, played);
+                                packed.push_back(record);
+                              });
+            return packed.size();
+          },
+          "games");
+  std::cout << "SAN cache of the packed replay: " << decode.lookups() << " lookups, "
+            << decode.hit_rate() * 100 << "% hits\n";
+  std::cout << "bytes per move: " << sizeof(Moves) << " decoded, "
+            << sizeof(PackedSan) + sizeof(PackedMove) << " packed and played\n";
+
+  if (!std::ranges::equal(sequential, parallel, same))
+  {
+    std::cout << "parallel replay does not match the sequential one\n";
+    return -1;
+  }
+  if (!std::ranges::equal(sequential, pulled, same))
+  {
+    std::cout << "pgn_games replay does not match the sequential one\n";
+    return -1;
+  }
+  if (!std::ranges::equal(sequential, packed, same))
+  {
+    std::cout << "packed replay does not match the sequential one\n";
+    return -1;
+  }
+  return 0;
+}
+
+// the games of the file written again as UCI from the squares the board resolved them to, then
+// both replayed: a UCI move is played from its source square with nothing to look for
+int bench_uci(const std::string& input_file)
+{
+  MappedFile mapping(input_file);
+  std::string uci;
+  std::vector<PackedMove> played;
+  {
+    TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+    ChessBoard board;
+    read_packed_games(scanner, 0,
+                      [&](const GameRecord& record, std::span<const PackedSan> moves)
+                      {
+                        board.reset();
+                        played.clear();
+                        replay_packed(moves, board, played);
+                        std::ostringstream o;
+                        for (PackedMove move : played)
+                          o << move << ' ';
+                        constexpr const char* results[] = {"*", "1-0", "0-1", "1/2-1/2"};
+                        o << results[static_cast<size_t>(record.result)] << "\n\n";
+                        uci += o.str();
+                      });
+  }
+
+  // the boards are printed on a separate pass, to compare them
+  auto replay = [](const char* begin, const char* end, std::vector<std::string>* boards)
+  {
+    TokenScanner scanner(begin, end);
+    size_t moves = 0;
+    replay_games(scanner, 0,
+                 [&](const GameRecord& record, const ChessBoard& board)
+                 {
+                   moves += record.plies;
+                   if (boards)
+                   {
+                     std::ostringstream o;
+                     o << board;
+                     boards->push_back(o.str());
+                   }
+                 });
+    return moves;
+  };
+  measure("SAN replay", mapping.size(),
+          [&] { return replay(mapping.data(), mapping.data() + mapping.size(), nullptr); },
+          "moves");
+  measure("UCI replay", uci.size(),
+          [&] { return replay(uci.data(), uci.data() + uci.size(), nullptr); }, "moves");
+
+  std::vector<std::string> san_boards, uci_boards;
+  replay(mapping.data(), mapping.data() + mapping.size(), &san_boards);
+  replay(uci.data(), uci.data() + uci.size(), &uci_boards);
+  if (san_boards != uci_boards)
+  {
+    std::cout << "UCI replay does not match the SAN one\n";
+    return -1;
+  }
+  return 0;
+}
+
+// evicts the file from the page cache, so the next pass over it has to go to the disk
+void drop_page_cache(const std::string& path)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0 || ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+    throw std::runtime_error("failed to drop the page cache of [" + path + "]");
+  ::close(fd);
+}
+
+// cold cache scans: each pass starts with the file evicted, so they measure how well reading
+// from the disk overlaps with lexing
+int bench_cold(const std::string& input_file, size_t runs)
+{
+  const size_t size = MappedFile(input_file).size();
+  for (size_t run = 0; run < runs; ++run)
+  {
+    drop_page_cache(input_file);
+    measure("cold mmap", size,
+            [&]
+            {
+              MappedFile mapping(input_file);
+              TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+              return count_tokens(scanner);
+            });
+
+    drop_page_cache(input_file);
+    measure("cold read", size,
+            [&]
+            {
+              FdSource source(input_file);
+              TokenScanner scanner(source);
+              return count_tokens(scanner);
+            });
+
+    drop_page_cache(input_file);
+    measure("cold read-ahead", size,
+            [&]
+            {
+              ReadAheadSource source(std::make_unique<FdSource>(input_file));
+              TokenScanner scanner(source);
+              return count_tokens(scanner);
+            });
+  }
+  return 0;
+}
+
+// building the index against a bare read of the file, which is as fast as it could ever get
+int bench_index(const std::string& input_file)
+{
+  MappedFile mapping(input_file);
+  measure("read", mapping.size(),
+          [&]
+          {
+            FdSource source(input_file);
+            std::vector<char> buffer(TokenScanner::BLOCK_SIZE);
+            size_t lines = 0;
+            while (size_t n = source.read(buffer.data(), buffer.size()))
+              lines += std::count(buffer.data(), buffer.data() + n, '\n');
+            return lines;
+          },
+          "lines");
+
+  measure("build index", mapping.size(),
+          [&] { return build_game_index(mapping.data(), mapping.data() + mapping.size()).size(); },
+          "games");
+
+  std::remove(GameIndex::sidecar_path(input_file).c_str());
+  measure("build and save index", mapping.size(),
+          [&] { return GameIndex(input_file, mapping.data(), mapping.size()).size(); }, "games");
+  measure("load index", mapping.size(),
+          [&]
+          {
+            GameIndex index(input_file, mapping.data(), mapping.size());
+            if (!index.loaded_from_sidecar())
+              throw std::runtime_error("the saved index was not picked up");
+            return index.size();
+          },
+          "games");
+  return 0;
+}
+
+// token throughput of the lexer: from stdin, through the decompressor for a compressed file, or
+// over a mapping, in batches and through an istream for a plain one
+int bench_scan(const std::string& input_file)
+{
+  if (input_file == "-")
+  {
+    // streaming from a pipe, the size is only known afterwards
+    auto source = open_decompressed(std::make_unique<FdSource>(STDIN_FILENO));
+    TokenScanner scanner(*source);
+    auto start = std::chrono::steady_clock::now();
+    size_t tokens = count_tokens(scanner);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const uint64_t bytes = scanner.bytes_scanned();
+
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    std::cout << "stdin: " << tokens << " tokens, " << bytes << " bytes in " << elapsed.count()
+              << "s, " << (bytes / 1e6) / elapsed.count() << " MB/s, max rss "
+              << usage.ru_maxrss / 1024 << " MiB\n";
+    return 0;
+  }
+
+  MappedFile mapping(input_file);
+  std::cout << "scan kernels: " << scan_kernels().name << "\n";
+  const Compression compression = detect_compression(mapping.data(), mapping.size());
+  if (compression != Compression::NONE)
+  {
+    // throughput is reported in decompressed bytes so it compares with `zcat file | bench scan -`
+    auto start = std::chrono::steady_clock::now();
+    DecompressingSource source(std::make_unique<FdSource>(input_file), compression);
+    TokenScanner scanner(source);
+    size_t tokens = count_tokens(scanner);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const uint64_t bytes = scanner.bytes_scanned();
+    std::cout << compression_name(compression) << ": " << tokens << " tokens, " << bytes
+              << " bytes (" << mapping.size() << " compressed) in " << elapsed.count() << "s, "
+              << (bytes / 1e6) / elapsed.count() << " MB/s\n";
+    return 0;
+  }
+
+  measure("mmap", mapping.size(),
+          [&]
+          {
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            return count_tokens(scanner);
+          });
+
+  measure("mmap batch", mapping.size(),
+          [&]
+          {
+            TokenScanner scanner(mapping.data(), mapping.data() + mapping.size());
+            std::vector<Token> batch(4096);
+            size_t tokens = 0;
+            while (size_t n = scanner.next_batch(batch))
+              tokens += n;
+            return tokens;
+          });
+
+  measure("istream", mapping.size(),
+          [&]
+          {
+            std::ifstream file(input_file);
+            TokenScanner scanner(file);
+            return count_tokens(scanner);
+          });
+  return 0;
+}
+
+struct Benchmark
+{
+  const char* name;
+  const char* input; // how the input is named in the usage text
+  const char* extra; // an optional argument after the input, nullptr for none
+  int (*run)(const std::string& input_file, const char* extra);
+};
+
+const Benchmark benchmarks[] = {
+  {"scan", "[input file | -]", nullptr,
+   [](const std::string& input_file, const char*) { return bench_scan(input_file); }},
+  {"replay", "[input file]", "[threads]",
+   [](const std::string& input_file, const char* threads)
+   {
+     return bench_replay(input_file, threads ? std::stoul(threads)
+                                             : std::max(1u, std::thread::hardware_concurrency()));
+   }},
+  {"index", "[input file]", nullptr,
+   [](const std::string& input_file, const char*) { return bench_index(input_file); }},
+  {"headers", "[input file]", nullptr,
+   [](const std::string& input_file, const char*) { return bench_headers(input_file); }},
+  {"parser", "[input file]", nullptr,
+   [](const std::string& input_file, const char*) { return bench_parser(input_file); }},
+  {"rav", "[input file]", nullptr,
+   [](const std::string& input_file, const char*) { return bench_rav(input_file); }},
+  {"uci", "[input file]", nullptr,
+   [](const std::string& input_file, const char*) { return bench_uci(input_file); }},
+  {"cold", "[input file]", "[runs]",
+   [](const std::string& input_file, const char* runs)
+   { return bench_cold(input_file, runs ? std::stoul(runs) : 3); }},
+};
+
+// generated from the table, so a new benchmark is listed as soon as it is added
+void print_usage()
+{
+  std::cout << "please run as";
+  const size_t count = std::size(benchmarks);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const Benchmark& benchmark = benchmarks[i];
+    std::cout << (i == 0 ? " " : i + 1 == count ? " or " : ", ") << "./bench " << benchmark.name
+              << " " << benchmark.input;
+    if (benchmark.extra)
+      std::cout << " " << benchmark.extra;
+  }
+  std::cout << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+  try
+  {
+    for (const Benchmark& benchmark : benchmarks)
+    {
+      if (argc >= 3 && argc <= (benchmark.extra ? 4 : 3) &&
+          std::strcmp(argv[1], benchmark.name) == 0)
+        return benchmark.run(argv[2], argc == 4 ? argv[3] : nullptr);
+    }
+  }
+  catch (const std::exception& e)
+  {
+    std::cout << "got exception while executing the benchmark [" << e.what() << "] \n";
+    return -1;
+  }
+
+  print_usage();
+  return -1;
+}
@@ -16,8 +16,10 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <assert.h>
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <ostream>
@@ -46,8 +48,27 @@ class ChessBoard
   std::vector<Cell> double_pawn_moves_;
   static constexpr size_t _N_ = 8;
 
+  struct JournalEntry
+  {
+    uint8_t square; // x * 8 + y
+    Cell before;
+  };
+  std::vector<JournalEntry> journal_;
+  bool journaling_ = false;
+
+  // every write to a cell goes through here, so a journaling board could take it back
+  Cell& edit(size_t x, size_t y)
+  {
+    if (journaling_)
+      journal_.push_back({static_cast<uint8_t>(x * _N_ + y), board_[x][y]});
+    return board_[x][y];
+  }
+
 public:
-  ChessBoard()
+  ChessBoard() { reset(); }
+
+  // back to the initial position, reusing the storage so one board could replay many games
+  void reset()
   {
     clear();
 
@@ -71,228 +92,311 @@ public:
   }
 
   Cell get(Coordinates c) const { return board_[*c.x][*c.y]; }
-  void clear() { board_ = {_N_, std::vector<Cell>(_N_, {false, '.'})}; }
+  void clear()
+  {
+    if (board_.empty())
+      board_ = {_N_, std::vector<Cell>(_N_, {false, '.'})};
+    else
+    {
+      for (auto& row : board_)
+        std::fill(row.begin(), row.end(), Cell{false, '.'});
+    }
+    journal_.clear();
+  }
+
+  // With the journal on, the cells a move changes are recorded as they were, so the position
+  // at mark() can be gone back to with undo() instead of keeping a copy of the board: a move
+  // writes about four cells. Going back is only possible to a mark taken since the journal was
+  // last turned on or cleared.
+  void set_journaling(bool on)
+  {
+    journaling_ = on;
+    journal_.clear();
+  }
+  size_t mark() const { return journal_.size(); }
+  void undo(size_t mark)
+  {
+    INTERNAL_ASSERT(mark <= journal_.size());
+    while (journal_.size() > mark)
+    {
+      const JournalEntry& entry = journal_.back();
+      board_[entry.square / _N_][entry.square % _N_] = entry.before;
+      journal_.pop_back();
+    }
+  }
+  // forgets what could be undone, for when no mark before now is needed any more
+  void drop_journal() { journal_.clear(); }
 
-  void apply(const Moves& move)
+  void apply(const Moves& move) { INTERNAL_ASSERT(try_apply(move)); }
+  void apply(PackedSan move) { INTERNAL_ASSERT(try_apply(move)); }
+
+  // Applies the move unless it can not be played in the position, returning false then with no
+  // exception thrown: the board is left somewhere along the move and has to be reset. `played`
+  // gets the squares the move was resolved to, it is left alone for a Finish or an Ignore.
+  bool try_apply(const Moves& move, PackedMove* played = nullptr)
   {
     return std::visit(
       overloaded{[&](const NextMove& val)
                  {
-                   INTERNAL_ASSERT(val.piece != '\0');
-
-                   Coordinates dst = val.dst;
-                   Coordinates src = val.src;
-                   INTERNAL_ASSERT(dst.y.has_value());
-
-                   CoordinatesToChar src_candidates;
-                   {
-                     if (!src.y && !src.x)
-                     {
-                       for (size_t x = 0; x <= _N_ - 1; ++x)
-                       {
-                         for (size_t y = 0; y <= _N_ - 1; ++y)
-                         {
-                           const Cell& c = board_[x][y];
-                           if (c.piece == val.piece && c.is_white == val.is_white_move)
-                             src_candidates.emplace(x, y);
-                         }
-                       }
-                     }
-                     else if (!src.y)
-                     {
-                       int x = src.x.value();
-                       for (size_t y = 0; y <= _N_ - 1; ++y)
-                       {
-                         const Cell& c = board_[x][y];
-                         if (c.piece == val.piece && c.is_white == val.is_white_move)
-                           src_candidates.emplace(x, y);
-                       }
-                     }
-                     else if (!src.x)
-                     {
-                       int y = src.y.value();
-                       for (size_t x = 0; x <= _N_ - 1; ++x)
-                       {
-                         const Cell& c = board_[x][y];
-                         if (c.piece == val.piece && c.is_white == val.is_white_move)
-                           src_candidates.emplace(x, y);
-                       }
-                     }
-                     else
-                     {
-                       src_candidates.emplace(src.x, src.y);
-                     }
-                   }
-                   INTERNAL_ASSERT(!src_candidates.empty());
-
-                   CoordinatesToChar dst_candidates;
-                   {
-                     if (!dst.y)
-                     {
-                       int x = dst.x.value();
-                       for (size_t y = 0; y <= _N_ - 1; ++y)
-                       {
-                         const Cell& c = board_[x][y];
-                         if (c.piece == '.' || (val.capture /*&& c.is_white != val.is_white_move*/))
-                           dst_candidates.emplace(x, y);
-                       }
-                     }
-                     else if (!dst.x)
-                     {
-                       int y = dst.y.value();
-                       for (size_t x = 0; x <= _N_ - 1; ++x)
-                       {
-                         const Cell& c = board_[x][y];
-                         if (c.piece == '.' || (val.capture /*&& c.is_white != val.is_white_move*/))
-                           dst_candidates.emplace(x, y);
-                       }
-                     }
-                     else
-                     {
-                       dst_candidates.emplace(dst.x, dst.y);
-                     }
-                   }
-                   INTERNAL_ASSERT(!dst_candidates.empty());
-
-                   size_t matches = 0;
-                   Coordinates final_src;
-                   Coordinates final_dst;
-                   bool found_match = false;
-                   for (const auto& src : src_candidates)
-                   {
-                     for (const auto& dst : dst_candidates)
-                     {
-                       bool locked = is_locked(src, dst, val.capture, val.is_white_move);
-                       if (locked)
-                       {
-                         continue;
-                       }
-
-                       switch (val.piece)
-                       {
-                       case 'P':
-                         matches += can_move_pawn(src, dst, val.capture, val.is_white_move);
-                         break;
-                       case 'R':
-                         matches += can_move_rook(src, dst, val.capture, val.is_white_move);
-                         break;
-                       case 'Q':
-                         matches += can_move_queen(src, dst, val.capture, val.is_white_move);
-                         break;
-                       case 'N':
-                         matches += can_move_knight(src, dst, val.capture, val.is_white_move);
-                         break;
-                       case 'B':
-                         matches += can_move_bishop(src, dst, val.capture, val.is_white_move);
-                         break;
-                       case 'K':
-                         matches += can_move_king(src, dst, val.capture, val.is_white_move);
-                         break;
-                       default:
-                         INTERNAL_ASSERT(false);
-                         break;
-                       }
-
-                       if (!found_match && matches == 1)
-                       {
-                         final_src = src;
-                         final_dst = dst;
-                         found_match = true;
-
-                         // let's make sure to clear double move flag if the pawn
-                         // has moved or if it has been captured
-                         if (val.piece == 'P')
-                         {
-                           Cell& src_cell = board_[*final_src.x][*final_src.y];
-                           if (src_cell.double_move)
-                             src_cell.double_move = false;
-                         }
-                         else if (val.capture)
-                         {
-                           Cell& dst_cell = board_[*final_dst.x][*final_dst.y];
-                           if (dst_cell.double_move)
-                           {
-                             INTERNAL_ASSERT(dst_cell.piece == 'P');
-                             dst_cell.double_move = false;
-                           }
-                         }
-                       }
-                     }
-                   }
-                   INTERNAL_ASSERT(matches == 1);
-
-                   if (val.promote_piece)
-                   {
-                     // apply promotion
-                     board_[*final_dst.x][*final_dst.y].piece = *val.promote_piece;
-                   }
-                   else
-                   {
-                     // regular move
-                     board_[*final_dst.x][*final_dst.y].piece = val.piece;
-                   }
-
-                   // rest the src cell
-                   board_[*final_src.x][*final_src.y].piece = '.';
-
-                   // set the right yor
-                   board_[*final_dst.x][*final_dst.y].is_white = val.is_white_move;
-                 },
-                 [&](const QueenCastling& t)
-                 {
-                   if (t.is_white_move)
-                   {
-                     INTERNAL_ASSERT(is_free_cell({r('1'), f('c')}));
-                     INTERNAL_ASSERT(is_free_cell({r('1'), f('d')}));
-
-                     board_[r('1')][f('c')] = board_[r('1')][f('e')]; // move the king to 'c1'
-                     board_[r('1')][f('e')].piece = '.'; // clear the king's original square
-                     board_[r('1')][f('d')] = board_[r('1')][f('a')]; // move the rook to 'd1'
-                     board_[r('1')][f('a')].piece = '.'; // clear the rook's original square
-                   }
-                   else
-                   {
-                     INTERNAL_ASSERT(is_free_cell({r('8'), f('c')}));
-                     INTERNAL_ASSERT(is_free_cell({r('8'), f('d')}));
-
-                     board_[r('8')][f('c')] = board_[r('8')][f('e')]; // move the king to 'c8'
-                     board_[r('8')][f('e')].piece = '.'; // clear the king's original square
-                     board_[r('8')][f('d')] = board_[r('8')][f('a')]; // move the rook to 'd8'
-                     board_[r('8')][f('a')].piece = '.'; // clear the rook's original square
-                   }
-                 },
-                 [&](const Ignore& t)
-                 {
-                   // do nothing
+                   return play_san(val.piece, val.is_white_move, val.capture, val.src, val.dst,
+                                   val.promote_piece.value_or('\0'), played);
                  },
-                 [&](const KingCastling& t)
+                 [&](const LongMove& val)
                  {
-                   if (t.is_white_move)
-                   {
-                     INTERNAL_ASSERT(is_free_cell({r('1'), f('g')}));
-                     INTERNAL_ASSERT(is_free_cell({r('1'), f('f')}));
-
-                     board_[r('1')][f('g')] = board_[r('1')][f('e')]; // king moves to 'g1'
-                     board_[r('1')][f('e')].piece = '.'; // clear the king's original square
-                     board_[r('1')][f('f')] = board_[r('1')][f('h')]; // rook moves to 'f1'
-                     board_[r('1')][f('h')].piece = '.'; // clear the rook's original square
-                   }
-                   else
-                   {
-                     INTERNAL_ASSERT(is_free_cell({r('8'), f('g')}));
-                     INTERNAL_ASSERT(is_free_cell({r('8'), f('f')}));
-
-                     board_[r('8')][f('g')] = board_[r('8')][f('e')]; // king moves to 'g8'
-                     board_[r('8')][f('e')].piece = '.'; // clear the king's original square
-                     board_[r('8')][f('f')] = board_[r('8')][f('h')]; // rook moves to 'f8'
-                     board_[r('8')][f('h')].piece = '.'; // clear the rook original square
-                   }
+                   return play_long(val.from, val.to, val.piece, val.promote_piece,
+                                    val.is_white_move, val.capture, played);
                  },
-                 [&](const auto& t) {}},
+                 [&](const QueenCastling& t) { return castle_queen_side(t.is_white_move, played); },
+                 [&](const KingCastling& t) { return castle_king_side(t.is_white_move, played); },
+                 [&](const auto& t) { return true; }},
       move);
   }
 
+  // the same straight from the fields of a packed move, which is never unpacked into Moves
+  bool try_apply(PackedSan move, PackedMove* played = nullptr)
+  {
+    switch (move.index())
+    {
+    case index_of<NextMove>:
+      return play_san(move.piece(), move.white(), move.capture(), move.src(), move.dst(),
+                      move.promotion(), played);
+    case index_of<LongMove>:
+      return play_long(square(move.src()), square(move.dst()), move.piece(), move.promotion(),
+                       move.white(), move.capture(), played);
+    case index_of<QueenCastling>:
+      return castle_queen_side(move.white(), played);
+    case index_of<KingCastling>:
+      return castle_king_side(move.white(), played);
+    default:
+      return true;
+    }
+  }
+
+  // a SAN move: the piece is looked for among those which could go to the destination
+  bool play_san(char piece, bool is_white_move, bool capture, Coordinates src, Coordinates dst,
+                char promotion, PackedMove* played)
+  {
+    expire_double_moves(is_white_move);
+    if (piece == '\0')
+      return false;
+
+    if (!dst.y)
+      return false;
+
+    CoordinatesToChar src_candidates;
+    {
+      if (!src.y && !src.x)
+      {
+        for (size_t x = 0; x <= _N_ - 1; ++x)
+        {
+          for (size_t y = 0; y <= _N_ - 1; ++y)
+          {
+            const Cell& c = board_[x][y];
+            if (c.piece == piece && c.is_white == is_white_move)
+              src_candidates.emplace(x, y);
+          }
+        }
+      }
+      else if (!src.y)
+      {
+        int x = src.x.value();
+        for (size_t y = 0; y <= _N_ - 1; ++y)
+        {
+          const Cell& c = board_[x][y];
+          if (c.piece == piece && c.is_white == is_white_move)
+            src_candidates.emplace(x, y);
+        }
+      }
+      else if (!src.x)
+      {
+        int y = src.y.value();
+        for (size_t x = 0; x <= _N_ - 1; ++x)
+        {
+          const Cell& c = board_[x][y];
+          if (c.piece == piece && c.is_white == is_white_move)
+            src_candidates.emplace(x, y);
+        }
+      }
+      else
+      {
+        src_candidates.emplace(src.x, src.y);
+      }
+    }
+    if (src_candidates.empty())
+      return false;
+
+    CoordinatesToChar dst_candidates;
+    {
+      if (!dst.y)
+      {
+        int x = dst.x.value();
+        for (size_t y = 0; y <= _N_ - 1; ++y)
+        {
+          const Cell& c = board_[x][y];
+          if (c.piece == '.' || (capture /*&& c.is_white != is_white_move*/))
+            dst_candidates.emplace(x, y);
+        }
+      }
+      else if (!dst.x)
+      {
+        int y = dst.y.value();
+        for (size_t x = 0; x <= _N_ - 1; ++x)
+        {
+          const Cell& c = board_[x][y];
+          if (c.piece == '.' || (capture /*&& c.is_white != is_white_move*/))
+            dst_candidates.emplace(x, y);
+        }
+      }
+      else
+      {
+        dst_candidates.emplace(dst.x, dst.y);
+      }
+    }
+    if (dst_candidates.empty())
+      return false;
+
+    size_t matches = 0;
+    Coordinates final_src;
+    Coordinates final_dst;
+    bool found_match = false;
+    for (const auto& src : src_candidates)
+    {
+      for (const auto& dst : dst_candidates)
+      {
+        bool locked = is_locked(src, dst, capture, is_white_move);
+        if (locked)
+        {
+          continue;
+        }
+
+        if (!is_piece_letter(piece))
+          return false;
+        matches += can_move(piece, src, dst, capture, is_white_move);
+
+        if (!found_match && matches == 1)
+        {
+          final_src = src;
+          final_dst = dst;
+          found_match = true;
+          if (!clear_double_move(final_src, final_dst, piece, capture))
+            return false;
+        }
+      }
+    }
+    if (matches != 1)
+      return false;
+
+    move_piece(final_src, final_dst, piece, promotion, is_white_move);
+    if (played)
+      *played = PackedMove(square(final_src), square(final_dst), promotion);
+    return true;
+  }
+
+  // a move with both squares given: no candidates to look for, only the one move to check
+  bool play_long(unsigned from, unsigned to, char written_piece, char promotion,
+                 bool is_white_move, bool written_capture, PackedMove* played)
+  {
+    expire_double_moves(is_white_move);
+    const Coordinates src{from / _N_, from % _N_};
+    const Coordinates dst{to / _N_, to % _N_};
+    const Cell& moving = board_[*src.x][*src.y];
+    if (moving.piece == '.' || moving.is_white != is_white_move ||
+        (written_piece && written_piece != moving.piece) || src == dst)
+      return false;
+    const char piece = moving.piece;
+    const Cell& target = board_[*dst.x][*dst.y];
+
+    // e1g1 as UCI has it, or e1h1 taking the rook as some GUIs write it
+    const int rank = is_white_move ? r('1') : r('8');
+    if (piece == 'K' && src == Coordinates{rank, f('e')} && *dst.x == rank &&
+        (std::abs(*dst.y - *src.y) == 2 ||
+         ((*dst.y == f('a') || *dst.y == f('h')) && target.piece == 'R' &&
+          target.is_white == is_white_move)))
+    {
+      if (*dst.y > *src.y)
+        return castle_king_side(is_white_move, played);
+      return castle_queen_side(is_white_move, played);
+    }
+
+    // a pawn changing its file captures, en passant when the square is empty
+    const bool capture = target.piece != '.' || (piece == 'P' && *src.y != *dst.y);
+    const int last_rank = is_white_move ? r('8') : r('1');
+    if ((written_capture && !capture) || (promotion && (piece != 'P' || *dst.x != last_rank)) ||
+        is_locked(src, dst, capture, is_white_move) ||
+        !can_move(piece, src, dst, capture, is_white_move) ||
+        !clear_double_move(src, dst, piece, capture))
+      return false;
+
+    move_piece(src, dst, piece, promotion, is_white_move);
+    if (played)
+      *played = PackedMove(from, to, promotion);
+    return true;
+  }
+
+  bool castle_queen_side(bool is_white_move, PackedMove* played)
+  {
+    expire_double_moves(is_white_move);
+    if (is_white_move)
+    {
+      if (!is_free_cell({r('1'), f('c')}) || !is_free_cell({r('1'), f('d')}))
+        return false;
+
+      edit(r('1'), f('c')) = board_[r('1')][f('e')]; // move the king to 'c1'
+      edit(r('1'), f('e')).piece = '.'; // clear the king's original square
+      edit(r('1'), f('d')) = board_[r('1')][f('a')]; // move the rook to 'd1'
+      edit(r('1'), f('a')).piece = '.'; // clear the rook's original square
+    }
+    else
+    {
+      if (!is_free_cell({r('8'), f('c')}) || !is_free_cell({r('8'), f('d')}))
+        return false;
+
+      edit(r('8'), f('c')) = board_[r('8')][f('e')]; // move the king to 'c8'
+      edit(r('8'), f('e')).piece = '.'; // clear the king's original square
+      edit(r('8'), f('d')) = board_[r('8')][f('a')]; // move the rook to 'd8'
+      edit(r('8'), f('a')).piece = '.'; // clear the rook's original square
+    }
+    if (played)
+    {
+      const int rank = is_white_move ? r('1') : r('8');
+      *played = PackedMove(square({rank, f('e')}), square({rank, f('c')}), '\0', true);
+    }
+    return true;
+  }
+
+  bool castle_king_side(bool is_white_move, PackedMove* played)
+  {
+    expire_double_moves(is_white_move);
+    if (is_white_move)
+    {
+      if (!is_free_cell({r('1'), f('g')}) || !is_free_cell({r('1'), f('f')}))
+        return false;
+
+      edit(r('1'), f('g')) = board_[r('1')][f('e')]; // king moves to 'g1'
+      edit(r('1'), f('e')).piece = '.'; // clear the king's original square
+      edit(r('1'), f('f')) = board_[r('1')][f('h')]; // rook moves to 'f1'
+      edit(r('1'), f('h')).piece = '.'; // clear the rook's original square
+    }
+    else
+    {
+      if (!is_free_cell({r('8'), f('g')}) || !is_free_cell({r('8'), f('f')}))
+        return false;
+
+      edit(r('8'), f('g')) = board_[r('8')][f('e')]; // king moves to 'g8'
+      edit(r('8'), f('e')).piece = '.'; // clear the king's original square
+      edit(r('8'), f('f')) = board_[r('8')][f('h')]; // rook moves to 'f8'
+      edit(r('8'), f('h')).piece = '.'; // clear the rook original square
+    }
+    if (played)
+    {
+      const int rank = is_white_move ? r('1') : r('8');
+      *played = PackedMove(square({rank, f('e')}), square({rank, f('g')}), '\0', true);
+    }
+    return true;
+  }
+
   bool in_range(int idx) { return 0 <= idx && idx <= (int)_N_ - 1; }
+  static unsigned square(Coordinates c) { return static_cast<unsigned>(*c.x * _N_ + *c.y); }
 
   bool is_locked(Coordinates src, Coordinates dst, bool capture, bool is_white_move)
   {
@@ -348,7 +452,9 @@ public:
 
     if (idx != -1)
     {
-      INTERNAL_ASSERT(king.y && king.x);
+      // a king found without its square is a board gone wrong, no move could be checked on it
+      if (!king.y || !king.x)
+        return true;
       int opposite_idx = (idx + _N_ / 2) % _N_;
       Coordinates ray = src;
       do
@@ -361,9 +467,9 @@ public:
         const Cell& c = board_[*ray.x][*ray.y];
         if (ray == dst)
         {
-          // we must be attackign it
-          INTERNAL_ASSERT(c.is_white != is_white_move);
-          INTERNAL_ASSERT(capture);
+          // we must be attackign it, anything else is no move at all
+          if (c.is_white == is_white_move || !capture)
+            return true;
 
           // let's assume it was captured, but second piece in line may still be checking our king,
           // so need to check if the is the case
@@ -406,20 +512,23 @@ public:
       result = (dx == 1 && dy == 1);
 
       // detect en passant
-      Cell& dest_cell = board_[*dst.x][*dst.y];
+      const Cell& dest_cell = board_[*dst.x][*dst.y];
       if (result && dest_cell.piece == '.')
       {
         Coordinates x;
         int d = *dst.y - *src.y;
         x.y = *src.y + d;
         x.x = *src.x;
-        INTERNAL_ASSERT(in_range(*x.y));
-
-        Cell& captured_cell = board_[*x.x][*x.y];
-        INTERNAL_ASSERT(captured_cell.piece == 'P');
-        INTERNAL_ASSERT(captured_cell.is_white == !is_white_move);
+        if (!in_range(*x.y))
+          return false;
+
+        // only a pawn which has made its double move on the ply before could be taken en passant
+        const Cell& passed_cell = board_[*x.x][*x.y];
+        if (passed_cell.piece != 'P' || passed_cell.is_white == is_white_move ||
+            !passed_cell.double_move)
+          return false;
         {
-          INTERNAL_ASSERT(captured_cell.double_move);
+          Cell& captured_cell = edit(*x.x, *x.y);
           captured_cell.piece = '.';
           captured_cell.double_move = false;
         }
@@ -443,7 +552,7 @@ public:
             return false;
 
           *ray.x += d[is_white_move];
-          return is_free_cell(ray) && (board_[*dst.x][*dst.y].double_move = true, true);
+          return is_free_cell(ray) && (edit(*dst.x, *dst.y).double_move = true, true);
         }
       }
       else if (dx == 1)
@@ -624,6 +733,72 @@ public:
     return result && is_valid_dest(dst, capture, is_white_move);
   }
 
+  bool can_move(char piece, Coordinates src, Coordinates dst, bool capture, bool is_white_move)
+  {
+    switch (piece)
+    {
+    case 'P':
+      return can_move_pawn(src, dst, capture, is_white_move);
+    case 'R':
+      return can_move_rook(src, dst, capture, is_white_move);
+    case 'Q':
+      return can_move_queen(src, dst, capture, is_white_move);
+    case 'N':
+      return can_move_knight(src, dst, capture, is_white_move);
+    case 'B':
+      return can_move_bishop(src, dst, capture, is_white_move);
+    case 'K':
+      return can_move_king(src, dst, capture, is_white_move);
+    default:
+      return false;
+    }
+  }
+
+  // A double move could only be answered en passant on the very next ply: the flags of the side
+  // to move were set on its previous move, so they are dropped before it moves again. A pawn
+  // which has moved on or been taken since had its flag cleared then, only the fourth rank of the
+  // side is left to look at.
+  void expire_double_moves(bool is_white_move)
+  {
+    const int rank = is_white_move ? r('4') : r('5');
+    for (size_t y = 0; y <= _N_ - 1; ++y)
+    {
+      if (board_[rank][y].double_move)
+        edit(rank, y).double_move = false;
+    }
+  }
+
+  // let's make sure to clear double move flag if the pawn has moved or if it has been captured
+  bool clear_double_move(Coordinates src, Coordinates dst, char piece, bool capture)
+  {
+    if (piece == 'P')
+    {
+      if (board_[*src.x][*src.y].double_move)
+        edit(*src.x, *src.y).double_move = false;
+    }
+    else if (capture)
+    {
+      const Cell& dst_cell = board_[*dst.x][*dst.y];
+      if (dst_cell.double_move)
+      {
+        if (dst_cell.piece != 'P')
+          return false;
+        edit(*dst.x, *dst.y).double_move = false;
+      }
+    }
+    return true;
+  }
+
+  void move_piece(Coordinates src, Coordinates dst, char piece, char promotion, bool is_white_move)
+  {
+    // the promotion if any or the same piece
+    edit(*dst.x, *dst.y).piece = promotion ? promotion : piece;
+    // rest the src cell
+    edit(*src.x, *src.y).piece = '.';
+    // set the right yor
+    edit(*dst.x, *dst.y).is_white = is_white_move;
+  }
+
   bool is_free_cell(Coordinates c) { return board_[*c.x][*c.y].piece == '.'; }
   bool is_valid_dest(Coordinates dst, bool capture, bool is_white_move)
   {
@@ -644,7 +819,7 @@ public:
     INTERNAL_ASSERT(c.y.has_value());
     INTERNAL_ASSERT(c.y <= _N_ - 1 && c.y >= 0);
     INTERNAL_ASSERT(c.x <= _N_ - 1 && c.x >= 0);
-    board_[*c.x][*c.y] = cell;
+    edit(*c.x, *c.y) = cell;
   }
 
   friend std::ostream& operator<<(std::ostream& o, const ChessBoard& b)
@@ -0,0 +1,90 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+// Where the streaming scanner gets its bytes from. read() fills up to `size` bytes and returns
+// how many were actually read, 0 meaning the end of the input. It is called once per block,
+// so a virtual call is of no concern here.
+class ByteSource
+{
+public:
+  virtual ~ByteSource() = default;
+  virtual size_t read(char* dst, size_t size) = 0;
+  virtual bool bad() const { return false; }
+};
+
+class IstreamSource : public ByteSource
+{
+  std::istream& file_;
+
+public:
+  explicit IstreamSource(std::istream& file) : file_(file) {}
+
+  size_t read(char* dst, size_t size) override
+  {
+    file_.read(dst, size);
+    return file_.gcount();
+  }
+
+  bool bad() const override { return file_.bad(); }
+};
+
+// plain file descriptor, so stdin and pipes do not go through iostream buffering
+class FdSource : public ByteSource
+{
+  int fd_;
+  bool owned_;
+
+public:
+  explicit FdSource(int fd) : fd_(fd), owned_(false) {}
+  explicit FdSource(const std::string& path) : fd_(::open(path.c_str(), O_RDONLY)), owned_(true)
+  {
+    if (fd_ < 0)
+    {
+      throw std::runtime_error(std::string("failed to open file [").append(path).append("]"));
+    }
+  }
+
+  FdSource(const FdSource&) = delete;
+  FdSource& operator=(const FdSource&) = delete;
+
+  ~FdSource()
+  {
+    if (owned_)
+      ::close(fd_);
+  }
+
+  size_t read(char* dst, size_t size) override
+  {
+    for (;;)
+    {
+      const ssize_t n = ::read(fd_, dst, size);
+      if (n >= 0)
+        return static_cast<size_t>(n);
+      if (errno != EINTR)
+        throw std::runtime_error(std::string("failed to read input: ").append(std::strerror(errno)));
+    }
+  }
+};
@@ -15,73 +15,443 @@
  */
 
 #include "board.h"
+#include "byte_source.h"
+#include "commands.h"
 #include "common.h"
+#include "decompress.h"
+#include "game_index.h"
+#include "headers.h"
+#include "mapped_file.h"
 #include "parser.h"
+#include "read_ahead.h"
+#include "replay.h"
 #include "scanner.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+struct Options
+{
+  std::string input_file;
+  bool stats = false;
+  bool read_ahead = false;
+  bool all = false;
+  bool commands = false; // per ply %clk, %emt and %eval columns with --all
+  std::string rejects; // lenient --all, malformed games are listed there instead of aborting
+  bool headers = false;
+  std::string tags; // columns printed by --headers, the seven tag roster when empty
+  size_t threads = 1;
+  size_t game = 0; // 1-based, 0 replays the first game of the input
+};
+
+void print_usage()
+{
+  std::cout << "please run as ./chess_replay [--stats] [--read-ahead] [--all [--threads N] "
+               "[--commands] [--rejects FILE]] [--headers [--tags LIST]] [--game K] [input file | "
+               "-]; say ./chess_replay /data/input/input.data or ./chess_replay games.pgn.zst; "
+               "gzip, bzip2 and zstd inputs are recognized by their content. --all replays every "
+               "game and prints the result, the number of plies and the final board of each, split "
+               "across N threads at the games of its .idx sidecar for plain PGN files, on one "
+               "thread otherwise with a note on stderr. --commands adds the [%clk], [%emt] and "
+               "[%eval] comment commands of every ply of the main line, read on one thread. "
+               "--rejects skips a malformed game instead of stopping and writes its number, "
+               "offset, the offset of the error and the reason to FILE, read on one thread. "
+               "--headers prints the seven tag roster of every game as tab separated values "
+               "without replaying the moves, --tags WhiteElo:int,ECO,Date:date prints the listed "
+               "tags instead, only those are decoded. --game K replays the K-th game of a plain "
+               "PGN file via its .idx sidecar, which is built on the first use. --read-ahead reads "
+               "the input on a separate thread, which pays off on cold caches. --all, --headers "
+               "and --game exclude each other";
+}
+
+std::optional<Options> parse_options(int argc, char* argv[])
+{
+  Options options;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], "--stats") == 0)
+      options.stats = true;
+    else if (std::strcmp(argv[i], "--read-ahead") == 0)
+      options.read_ahead = true;
+    else if (std::strcmp(argv[i], "--all") == 0)
+      options.all = true;
+    else if (std::strcmp(argv[i], "--commands") == 0)
+      options.commands = true;
+    else if (std::strcmp(argv[i], "--rejects") == 0 && i + 1 < argc)
+      options.rejects = argv[++i];
+    else if (std::strcmp(argv[i], "--headers") == 0)
+      options.headers = true;
+    else if (std::strcmp(argv[i], "--tags") == 0 && i + 1 < argc)
+    {
+      options.headers = true;
+      options.tags = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      options.threads = std::strtoull(argv[++i], nullptr, 10);
+      if (options.threads == 0)
+        return {};
+    }
+    else if (std::strcmp(argv[i], "--game") == 0 && i + 1 < argc)
+    {
+      options.game = std::strtoull(argv[++i], nullptr, 10);
+      if (options.game == 0)
+        return {};
+    }
+    else if (options.input_file.empty())
+      options.input_file = argv[i];
+    else
+      return {};
+  }
+
+  if (options.input_file.empty())
+    return {};
+  // only the replay of every game is split across threads, prints commands or skips rejects
+  if ((options.threads > 1 || options.commands || !options.rejects.empty()) && !options.all)
+    return {};
+  // --all, --headers (or --tags) and --game each pick what is done with the input
+  if (int(options.all) + int(options.headers) + int(options.game != 0) > 1)
+    return {};
+  return options;
+}
+
+ChessBoard replay_first_game(TokenScanner& scanner)
+{
+  ChessBoard board;
+  BasicPGNParser<PackingMoveFactory> parser;
+  for (const auto& token : scanner)
+  {
+    if constexpr (PRINT_DEBUG_INFO)
+    {
+      std::cout << token << std::endl;
+    }
+    auto action = parser.consume_token(token, scanner.text(token));
+    if (action)
+    {
+      if (action->index() == index_of<Finish>)
+        break;
+
+      board.apply(*action);
+      if constexpr (PRINT_DEBUG_INFO)
+      {
+        std::cout << "\n NEW MOVE: " << unpack(*action) << "\n" << board;
+      }
+    }
+  }
+  return board;
+}
+
+void print_game(std::ostream& o, size_t number, const GameRecord& record, std::string_view board)
+{
+  o << "game " << number << " at offset " << record.offset << ": " << record.plies << " plies, "
+    << result_name(record.result) << "\n"
+    << board << "\n";
+}
+
+// one tab separated line per command, with a column for every ply of the main line
+void print_commands(std::ostream& o, const PlyCommands& commands)
+{
+  auto print = [&](const char* name, const std::vector<int32_t>& values, auto write)
+  {
+    o << name;
+    for (int32_t value : values)
+    {
+      o << '\t';
+      write(o, value);
+    }
+    o << '\n';
+  };
+  print("clk", commands.clock, write_clock);
+  print("emt", commands.elapsed, write_clock);
+  print("eval", commands.eval, write_eval);
+}
+
+// Every game of the input is replayed and printed as soon as its result is read, so memory
+// stays flat whatever the number of games. Plain files could be split across threads instead,
+// their games are then printed in file order once all of them are replayed.
+int replay_all_games(const Options& options, TokenScanner& scanner, const MappedFile* mapping,
+                     std::chrono::steady_clock::time_point start)
+{
+  size_t games = 0;
+  std::ostringstream board_text;
+  auto render = [&](const ChessBoard& board)
+  {
+    board_text.str({});
+    board_text << board;
+    return board_text.view();
+  };
+
+  // a malformed game is written to the rejects file with its number and the replay goes on
+  std::ofstream rejects;
+  if (!options.rejects.empty())
+  {
+    rejects.open(options.rejects);
+    if (!rejects)
+      throw std::runtime_error("cannot write " + options.rejects);
+  }
+  size_t rejected = 0;
+  PlyCommands commands;
+  CachingMoveFactory decode; // for the hit rate of --stats
+  auto replay = [&](auto& events)
+  {
+    auto on_game = [&](const GameRecord& record, const ChessBoard& board)
+    {
+      print_game(std::cout, ++games, record, render(board));
+      if (options.commands)
+      {
+        print_commands(std::cout, commands);
+        commands.clear();
+      }
+    };
+    auto on_reject = [&](const RejectedGame& game)
+    {
+      rejects << ++games << '\t' << game.offset << '\t' << game.error_offset << '\t'
+              << game.reason << '\n';
+      ++rejected;
+      commands.clear();
+    };
+    return options.rejects.empty()
+             ? replay_games(scanner, 0, on_game, events, &decode)
+             : replay_games_lenient(scanner, 0, on_game, on_reject, events, &decode);
+  };
+
+  uint64_t bytes = 0;
+  bool unfinished = false;
+  if (options.threads > 1 && mapping && !options.commands && options.rejects.empty())
+  {
+    // the threads start at games of the .idx sidecar, built and saved here on the first use
+    const GameIndex index(options.input_file, mapping->data(), mapping->size());
+    std::vector<const char*> bounds;
+    for (uint64_t offset : index.split(options.threads, mapping->size()))
+      bounds.push_back(mapping->data() + offset);
+    const auto replayed = replay_games_parallel(
+      mapping->data(), bounds,
+      [](const GameRecord& record, const ChessBoard& board)
+      {
+        std::ostringstream o;
+        o << board;
+        return std::pair{record, o.str()};
+      },
+      &unfinished, &decode);
+    for (const auto& [record, board] : replayed)
+      print_game(std::cout, ++games, record, board);
+    bytes = mapping->size();
+  }
+  else
+  {
+    if (options.threads > 1)
+      std::cerr << "note: --threads is ignored "
+                << (!mapping ? "for a streamed or compressed input"
+                             : "with --commands or --rejects")
+                << ", the games are replayed on one thread\n";
+    NoEvents none;
+    // the commands are decoded straight from the comments while the game is replayed
+    unfinished = options.commands ? replay(commands) : replay(none);
+    bytes = scanner.bytes_scanned();
+  }
+  if (unfinished)
+    std::cerr << "the input ends in the middle of game " << games + 1 << "\n";
+  std::cout.flush();
+
+  if (options.stats)
+  {
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    // `games` numbers the rejected games as well, the rate is of those replayed
+    const size_t replayed = games - rejected;
+    std::cerr << "replayed " << replayed << " games, " << bytes << " bytes in "
+              << elapsed.count() << "s, " << replayed / elapsed.count() << " games/s, "
+              << (bytes / 1e6) / elapsed.count() << " MB/s";
+    if (!options.rejects.empty())
+      std::cerr << ", " << rejected << " rejected";
+    std::cerr << ", SAN cache " << decode.hit_rate() * 100 << "% hits of " << decode.lookups()
+              << " lookups\n";
+  }
+  return 0;
+}
+
+// one line per game: number, offset and the projected tags, separated by tabs
+int print_all_headers(const Options& options, TokenScanner& scanner, const MappedFile* mapping,
+                      std::chrono::steady_clock::time_point start)
+{
+  const std::vector<TagColumn> columns =
+    options.tags.empty() ? seven_tag_roster() : parse_tag_projection(options.tags);
+  size_t games = 0;
+  std::string scratch;
+  auto print = [&](const GameHeaders& headers)
+  {
+    std::cout << ++games << '\t' << headers.offset;
+    for (const TagColumn& column : columns)
+    {
+      std::cout << '\t';
+      write_tag(std::cout, headers, column, scratch);
+    }
+    std::cout << '\n';
+  };
+
+  uint64_t bytes = 0;
+  if (mapping)
+  {
+    // the movetext of a mapped file is jumped over without lexing it
+    scan_headers(mapping->data(), mapping->data() + mapping->size(), print);
+    bytes = mapping->size();
+  }
+  else
+  {
+    scan_headers(scanner, print);
+    bytes = scanner.bytes_scanned();
+  }
+  std::cout.flush();
+
+  if (options.stats)
+  {
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "read headers of " << games << " games, " << bytes << " bytes in "
+              << elapsed.count() << "s, " << games / elapsed.count() << " games/s, "
+              << (bytes / 1e6) / elapsed.count() << " MB/s\n";
+  }
+  return 0;
+}
+
+// the game is located through the index, so nothing before it is lexed
+int replay_indexed_game(const Options& options)
+{
+  const std::string& input_file = options.input_file;
+  if (!MappedFile::is_mappable(input_file))
+    throw std::runtime_error("--game needs a regular file");
+  MappedFile mapping(input_file);
+  if (detect_compression(mapping.data(), mapping.size()) != Compression::NONE)
+    throw std::runtime_error("--game needs an uncompressed file");
+
+  const auto start = std::chrono::steady_clock::now();
+  GameIndex index(input_file, mapping.data(), mapping.size());
+  if (options.game > index.size())
+    throw std::runtime_error("there are only " + std::to_string(index.size()) + " games");
+
+  const GameIndexEntry& game = index[options.game - 1];
+  TokenScanner scanner(mapping.data() + game.offset, mapping.data() + game.offset + game.length);
+  std::cout << replay_first_game(scanner);
+  if (scanner.is_bad())
+    return -1;
+
+  if (options.stats)
+  {
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "game " << options.game << " of " << index.size() << " at offset "
+              << game.offset << ", index " << (index.loaded_from_sidecar() ? "loaded" : "built")
+              << " in " << elapsed.count() << "s\n";
+  }
+  return 0;
+}
 
 int main(int argc, char* argv[])
 {
-  if (argc != 2)
+  std::optional<Options> options = parse_options(argc, argv);
+  if (!options)
   {
-    std::cout << "please run as ./chess_replay [input file]; say "
-                 "./chess_replay /data/input/input.data";
+    print_usage();
     return -1;
   }
 
-  const std::string input_file = argv[1];
-  std::ifstream file;
+  // the per game output of --all is written through a plain buffered stream
+  std::ios::sync_with_stdio(false);
 
-  try
+  if (options->game)
   {
-    file.open(input_file);
-    if (!file.is_open())
+    try
     {
-      throw std::runtime_error(std::string("failed to open file [").append(input_file).append("]"));
+      return replay_indexed_game(*options);
+    }
+    catch (const std::exception& e)
+    {
+      std::cout << "got exception while executing the program [" << e.what() << "] \n";
+      return -1;
     }
+  }
+
+  const std::string& input_file = options->input_file;
+  std::unique_ptr<MappedFile> mapping;
+  std::unique_ptr<ByteSource> source;
+  std::optional<TokenScanner> scanner;
+
+  try
+  {
+    const auto start = std::chrono::steady_clock::now();
+    // compressed inputs are read on the decompression thread already
+    auto read_ahead = [&](std::unique_ptr<ByteSource> input, Compression compression)
+    {
+      if (options->read_ahead && compression == Compression::NONE)
+        return std::unique_ptr<ByteSource>(std::make_unique<ReadAheadSource>(std::move(input)));
+      return input;
+    };
 
-    ChessBoard board;
-    TokenScanner scanner(file);
-    PGNParser parser;
-    for (const auto& token : scanner)
-    {
-      std::visit(overloaded{[&](const std::monostate& t)
-                            {
-                              if constexpr (PRINT_DEBUG_INFO)
-                              {
-                                std::cout << "[]" << std::endl;
-                              }
-                            },
-                            [&](const auto& t)
-                            {
-                              if constexpr (PRINT_DEBUG_INFO)
-                              {
-                                std::cout << t << std::endl;
-                              }
-                            }},
-                 token);
-      auto action = parser.consume_token(token);
-      if (action)
+    Compression compression = Compression::NONE;
+    if (input_file == "-")
+    {
+      source = open_decompressed(std::make_unique<FdSource>(STDIN_FILENO), &compression);
+      source = read_ahead(std::move(source), compression);
+      scanner.emplace(*source);
+    }
+    else if (MappedFile::is_mappable(input_file))
+    {
+      mapping = std::make_unique<MappedFile>(input_file);
+      compression = detect_compression(mapping->data(), mapping->size());
+      if (compression == Compression::NONE && options->read_ahead)
+      {
+        // disk reads overlap with lexing, instead of the scanner stalling on page faults
+        mapping.reset();
+        source = read_ahead(std::make_unique<FdSource>(input_file), compression);
+        scanner.emplace(*source);
+      }
+      else if (compression == Compression::NONE)
+      {
+        // regular files are scanned straight from the page cache with no copying
+        scanner.emplace(mapping->data(), mapping->data() + mapping->size());
+      }
+      else
       {
-        if (std::get_if<Finish>(&*action))
-          break;
-
-        board.apply(*action);
-        if constexpr (PRINT_DEBUG_INFO)
-        {
-          std::cout << "\n NEW MOVE: " << *action << "\n" << board;
-        }
+        mapping.reset();
+        source = std::make_unique<DecompressingSource>(std::make_unique<FdSource>(input_file),
+                                                       compression);
+        scanner.emplace(*source);
       }
     }
+    else
+    {
+      // pipes and fifos are streamed through a fixed size window
+      source = open_decompressed(std::make_unique<FdSource>(input_file), &compression);
+      source = read_ahead(std::move(source), compression);
+      scanner.emplace(*source);
+    }
+
+    if (options->headers)
+      return print_all_headers(*options, *scanner, mapping.get(), start);
+    if (options->all)
+      return replay_all_games(*options, *scanner, mapping.get(), start);
 
-    if (file.bad())
+    const ChessBoard board = replay_first_game(*scanner);
+
+    if (scanner->is_bad())
     {
       std::cout << "Failed to parse file [" << input_file << "]\n";
       return -1;
     }
 
     std::cout << board;
+    if (options->stats)
+    {
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      const uint64_t bytes = scanner->bytes_scanned();
+      std::cerr << "scanned " << bytes << " bytes in " << elapsed.count() << "s, "
+                << (bytes / 1e6) / elapsed.count() << " MB/s\n";
+    }
     return 0;
   }
   catch (const std::exception& e)
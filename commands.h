@@ -0,0 +1,258 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// The values of the [%clk], [%emt] and [%eval] commands embedded in the brace comments of a move,
+// as lichess and broadcast exports write them. They are fixed point integers: clocks in
+// milliseconds, evaluations in centipawns from the side of white.
+struct MoveCommands
+{
+  static constexpr int32_t NONE = INT32_MIN; // the comments of the move have no such command
+  // a mate in n is MATE - n when white mates and -(MATE - n) when black does
+  static constexpr int32_t MATE = 1'000'000;
+
+  int32_t clock = NONE;   // left on the clock after the move
+  int32_t elapsed = NONE; // spent on the move, %emt
+  int32_t eval = NONE;
+};
+
+inline bool is_mate(int32_t eval)
+{
+  return eval != MoveCommands::NONE &&
+         (eval > MoveCommands::MATE / 2 || eval < -MoveCommands::MATE / 2);
+}
+
+// moves to the mate, negative when black mates
+inline int32_t mate_in(int32_t eval)
+{
+  return eval > 0 ? MoveCommands::MATE - eval : -(MoveCommands::MATE + eval);
+}
+
+namespace detail
+{
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// the first `digits` of a fraction scaled to that many digits, the rest is dropped
+inline int64_t parse_fraction(const char*& p, const char* end, int digits)
+{
+  int64_t value = 0;
+  int taken = 0;
+  for (; p < end && is_digit(*p); ++p)
+  {
+    if (taken < digits)
+    {
+      value = value * 10 + (*p - '0');
+      ++taken;
+    }
+  }
+  for (; taken < digits; ++taken)
+    value *= 10;
+  return value;
+}
+
+// h:mm:ss[.fff] to milliseconds, any number of fields down to plain seconds
+inline int32_t parse_clock(const char* p, const char* end)
+{
+  int64_t seconds = 0;
+  for (;;)
+  {
+    if (p == end || !is_digit(*p))
+      return MoveCommands::NONE;
+    int64_t field = 0;
+    for (; p < end && is_digit(*p) && field < INT32_MAX; ++p)
+      field = field * 10 + (*p - '0');
+    seconds = seconds * 60 + field;
+    if (seconds > INT32_MAX / 1000)
+      return MoveCommands::NONE;
+    if (p == end || *p != ':')
+      break;
+    ++p;
+  }
+
+  int64_t fraction = 0;
+  if (p < end && *p == '.')
+    fraction = parse_fraction(++p, end, 3);
+  if (p != end)
+    return MoveCommands::NONE;
+  return static_cast<int32_t>(seconds * 1000 + fraction);
+}
+
+// +1.25 or -0.3 pawns to centipawns, #3 or #-2 to a mate; a `,depth` suffix is ignored
+inline int32_t parse_eval(const char* p, const char* end)
+{
+  if (const char* comma = static_cast<const char*>(std::memchr(p, ',', end - p)))
+    end = comma;
+
+  const bool mate = p < end && *p == '#';
+  if (mate)
+    ++p;
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-'))
+    negative = *p++ == '-';
+  if (p == end || !(is_digit(*p) || (!mate && *p == '.')))
+    return MoveCommands::NONE;
+
+  int64_t value = 0;
+  for (; p < end && is_digit(*p); ++p)
+  {
+    value = value * 10 + (*p - '0');
+    if (value > MoveCommands::MATE / 200)
+      return MoveCommands::NONE;
+  }
+  if (mate)
+  {
+    if (p != end)
+      return MoveCommands::NONE;
+    return static_cast<int32_t>(negative ? -(MoveCommands::MATE - value)
+                                         : MoveCommands::MATE - value);
+  }
+
+  int64_t fraction = 0;
+  if (p < end && *p == '.')
+    fraction = parse_fraction(++p, end, 2);
+  if (p != end)
+    return MoveCommands::NONE;
+  value = value * 100 + fraction;
+  return static_cast<int32_t>(negative ? -value : value);
+}
+} // namespace detail
+
+// Decodes every known command of a comment, without its braces, into `move` straight from the
+// comment bytes. Unknown commands, malformed arguments and the text around them are skipped.
+inline void parse_commands(std::string_view comment, MoveCommands& move)
+{
+  const char* p = comment.data();
+  const char* const end = p + comment.size();
+  while (const char* open = static_cast<const char*>(std::memchr(p, '[', end - p)))
+  {
+    p = open + 1;
+    if (p == end || *p != '%')
+      continue;
+    const char* close = static_cast<const char*>(std::memchr(p, ']', end - p));
+    if (!close)
+      return;
+
+    const char* name = p + 1;
+    const char* name_end = name;
+    while (name_end < close && *name_end != ' ')
+      ++name_end;
+    const char* argument = name_end;
+    while (argument < close && *argument == ' ')
+      ++argument;
+    const char* argument_end = close;
+    while (argument_end > argument && argument_end[-1] == ' ')
+      --argument_end;
+
+    const std::string_view command(name, name_end - name);
+    if (command == "clk")
+      move.clock = detail::parse_clock(argument, argument_end);
+    else if (command == "emt")
+      move.elapsed = detail::parse_clock(argument, argument_end);
+    else if (command == "eval")
+      move.eval = detail::parse_eval(argument, argument_end);
+    p = close + 1;
+  }
+}
+
+// a clock as seconds with no trailing zeros of the fraction, NONE as nothing
+inline void write_clock(std::ostream& o, int32_t clock)
+{
+  if (clock == MoveCommands::NONE)
+    return;
+  o << clock / 1000;
+  if (const int32_t fraction = clock % 1000)
+  {
+    char digits[4] = {char('0' + fraction / 100), char('0' + fraction / 10 % 10),
+                      char('0' + fraction % 10), 0};
+    for (int i = 2; digits[i] == '0'; --i)
+      digits[i] = 0;
+    o << '.' << digits;
+  }
+}
+
+// an eval in pawns with two decimals or as #n, NONE as nothing
+inline void write_eval(std::ostream& o, int32_t eval)
+{
+  if (eval == MoveCommands::NONE)
+    return;
+  if (is_mate(eval))
+  {
+    o << '#' << mate_in(eval);
+    return;
+  }
+  const int32_t magnitude = eval < 0 ? -eval : eval;
+  o << (eval < 0 ? "-" : "") << magnitude / 100 << '.' << char('0' + magnitude / 10 % 10)
+    << char('0' + magnitude % 10);
+}
+
+// Per ply columns of the commands of the main line of a game, with an entry for every move
+// whether it has a comment or not. It is filled as the event handler of BasicPGNParser or
+// parse_pgn; comments inside of variations and before the first move are not taken. clear()
+// starts the next game and keeps the capacity.
+struct PlyCommands
+{
+  std::vector<int32_t> clock;
+  std::vector<int32_t> elapsed;
+  std::vector<int32_t> eval;
+
+  size_t plies() const { return clock.size(); }
+
+  void clear()
+  {
+    clock.clear();
+    elapsed.clear();
+    eval.clear();
+    depth_ = 0;
+  }
+
+  void on_move(std::string_view, bool, unsigned depth)
+  {
+    if (depth != 0)
+      return;
+    clock.push_back(MoveCommands::NONE);
+    elapsed.push_back(MoveCommands::NONE);
+    eval.push_back(MoveCommands::NONE);
+  }
+
+  void on_comment(std::string_view text)
+  {
+    // most comments carry no command at all
+    if (depth_ != 0 || clock.empty() || !std::memchr(text.data(), '%', text.size()))
+      return;
+    MoveCommands move{clock.back(), elapsed.back(), eval.back()};
+    parse_commands(text, move);
+    clock.back() = move.clock;
+    elapsed.back() = move.elapsed;
+    eval.back() = move.eval;
+  }
+
+  void on_variation_begin() { ++depth_; }
+  void on_variation_end()
+  {
+    if (depth_ > 0)
+      --depth_;
+  }
+
+private:
+  unsigned depth_ = 0;
+};
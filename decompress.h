@@ -0,0 +1,357 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "byte_source.h"
+#include "read_ahead.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef CHESS_REPLAY_HAS_ZLIB
+  #include <zlib.h>
+#endif
+#ifdef CHESS_REPLAY_HAS_BZIP2
+  #include <bzlib.h>
+#endif
+#ifdef CHESS_REPLAY_HAS_ZSTD
+  #include <zstd.h>
+#endif
+
+enum class Compression
+{
+  NONE,
+  GZIP,
+  BZIP2,
+  ZSTD
+};
+
+inline const char* compression_name(Compression c)
+{
+  switch (c)
+  {
+  case Compression::GZIP:
+    return "gzip";
+  case Compression::BZIP2:
+    return "bzip2";
+  case Compression::ZSTD:
+    return "zstd";
+  default:
+    return "none";
+  }
+}
+
+// formats are recognized by their magic bytes, file extensions are not trusted
+inline Compression detect_compression(const char* data, size_t size)
+{
+  const auto* b = reinterpret_cast<const unsigned char*>(data);
+  if (size >= 2 && b[0] == 0x1f && b[1] == 0x8b)
+    return Compression::GZIP;
+  if (size >= 3 && b[0] == 'B' && b[1] == 'Z' && b[2] == 'h')
+    return Compression::BZIP2;
+  if (size >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd)
+    return Compression::ZSTD;
+  return Compression::NONE;
+}
+
+inline constexpr size_t COMPRESSION_MAGIC_SIZE = 4;
+
+// Pulls compressed bytes from `input` and fills `dst` with decompressed ones, 0 meaning the end
+// of the data. Concatenated streams (pigz, pbzip2, zstd -T) are decoded one after another.
+class Decoder
+{
+public:
+  static constexpr size_t INPUT_BLOCK_SIZE = 256 * 1024;
+  virtual ~Decoder() = default;
+  virtual size_t decode(ByteSource& input, char* dst, size_t size) = 0;
+};
+
+#ifdef CHESS_REPLAY_HAS_ZLIB
+class GzipDecoder : public Decoder
+{
+  z_stream stream_{};
+  std::vector<char> in_ = std::vector<char>(INPUT_BLOCK_SIZE);
+  bool input_finished_ = false;
+  bool member_finished_ = false;
+
+public:
+  GzipDecoder()
+  {
+    // 32 lets zlib detect the gzip header itself
+    if (inflateInit2(&stream_, 15 + 32) != Z_OK)
+      throw std::runtime_error("failed to initialize gzip decoder");
+  }
+  ~GzipDecoder() { inflateEnd(&stream_); }
+
+  size_t decode(ByteSource& input, char* dst, size_t size) override
+  {
+    stream_.next_out = reinterpret_cast<Bytef*>(dst);
+    stream_.avail_out = static_cast<uInt>(size);
+    while (stream_.avail_out > 0)
+    {
+      if (stream_.avail_in == 0)
+      {
+        const size_t n = input_finished_ ? 0 : input.read(in_.data(), in_.size());
+        if (n == 0)
+        {
+          input_finished_ = true;
+          if (!member_finished_)
+            throw std::runtime_error("gzip input is truncated");
+          break;
+        }
+        stream_.next_in = reinterpret_cast<Bytef*>(in_.data());
+        stream_.avail_in = static_cast<uInt>(n);
+      }
+
+      if (member_finished_)
+      {
+        // more data after the end of a member is the next member
+        inflateReset(&stream_);
+        member_finished_ = false;
+      }
+
+      const int r = inflate(&stream_, Z_NO_FLUSH);
+      if (r == Z_STREAM_END)
+        member_finished_ = true;
+      else if (r != Z_OK && r != Z_BUF_ERROR)
+        throw std::runtime_error(std::string("gzip decoding failed: ")
+                                   .append(stream_.msg ? stream_.msg : std::to_string(r)));
+    }
+    return size - stream_.avail_out;
+  }
+};
+#endif
+
+#ifdef CHESS_REPLAY_HAS_BZIP2
+class Bzip2Decoder : public Decoder
+{
+  bz_stream stream_{};
+  std::vector<char> in_ = std::vector<char>(INPUT_BLOCK_SIZE);
+  bool input_finished_ = false;
+  bool stream_finished_ = false;
+
+  void init()
+  {
+    stream_ = {};
+    if (BZ2_bzDecompressInit(&stream_, 0, 0) != BZ_OK)
+      throw std::runtime_error("failed to initialize bzip2 decoder");
+  }
+
+public:
+  Bzip2Decoder() { init(); }
+  ~Bzip2Decoder() { BZ2_bzDecompressEnd(&stream_); }
+
+  size_t decode(ByteSource& input, char* dst, size_t size) override
+  {
+    stream_.next_out = dst;
+    stream_.avail_out = static_cast<unsigned>(size);
+    while (stream_.avail_out > 0)
+    {
+      if (stream_.avail_in == 0)
+      {
+        const size_t n = input_finished_ ? 0 : input.read(in_.data(), in_.size());
+        if (n == 0)
+        {
+          input_finished_ = true;
+          if (!stream_finished_)
+            throw std::runtime_error("bzip2 input is truncated");
+          break;
+        }
+        stream_.next_in = in_.data();
+        stream_.avail_in = static_cast<unsigned>(n);
+      }
+
+      if (stream_finished_)
+      {
+        // bzip2 has no reset, so the next stream needs a fresh decoder
+        char* next_in = stream_.next_in;
+        const unsigned avail_in = stream_.avail_in;
+        char* next_out = stream_.next_out;
+        const unsigned avail_out = stream_.avail_out;
+        BZ2_bzDecompressEnd(&stream_);
+        init();
+        stream_.next_in = next_in;
+        stream_.avail_in = avail_in;
+        stream_.next_out = next_out;
+        stream_.avail_out = avail_out;
+        stream_finished_ = false;
+      }
+
+      const int r = BZ2_bzDecompress(&stream_);
+      if (r == BZ_STREAM_END)
+        stream_finished_ = true;
+      else if (r != BZ_OK)
+        throw std::runtime_error(std::string("bzip2 decoding failed: ").append(std::to_string(r)));
+    }
+    return size - stream_.avail_out;
+  }
+};
+#endif
+
+#ifdef CHESS_REPLAY_HAS_ZSTD
+class ZstdDecoder : public Decoder
+{
+  ZSTD_DStream* stream_;
+  std::vector<char> in_ = std::vector<char>(INPUT_BLOCK_SIZE);
+  ZSTD_inBuffer in_buffer_{in_.data(), 0, 0};
+  bool input_finished_ = false;
+  bool frame_finished_ = false;
+
+public:
+  ZstdDecoder() : stream_(ZSTD_createDStream())
+  {
+    if (!stream_ || ZSTD_isError(ZSTD_initDStream(stream_)))
+      throw std::runtime_error("failed to initialize zstd decoder");
+  }
+  ~ZstdDecoder() { ZSTD_freeDStream(stream_); }
+
+  size_t decode(ByteSource& input, char* dst, size_t size) override
+  {
+    ZSTD_outBuffer out{dst, size, 0};
+    while (out.pos < out.size)
+    {
+      if (in_buffer_.pos == in_buffer_.size)
+      {
+        const size_t n = input_finished_ ? 0 : input.read(in_.data(), in_.size());
+        if (n == 0)
+        {
+          input_finished_ = true;
+          if (!frame_finished_)
+            throw std::runtime_error("zstd input is truncated");
+          break;
+        }
+        in_buffer_ = {in_.data(), n, 0};
+      }
+
+      // concatenated frames are handled by the stream itself
+      const size_t r = ZSTD_decompressStream(stream_, &out, &in_buffer_);
+      if (ZSTD_isError(r))
+        throw std::runtime_error(std::string("zstd decoding failed: ").append(ZSTD_getErrorName(r)));
+      frame_finished_ = (r == 0);
+    }
+    return out.pos;
+  }
+};
+#endif
+
+inline std::unique_ptr<Decoder> make_decoder(Compression c)
+{
+  switch (c)
+  {
+#ifdef CHESS_REPLAY_HAS_ZLIB
+  case Compression::GZIP:
+    return std::make_unique<GzipDecoder>();
+#endif
+#ifdef CHESS_REPLAY_HAS_BZIP2
+  case Compression::BZIP2:
+    return std::make_unique<Bzip2Decoder>();
+#endif
+#ifdef CHESS_REPLAY_HAS_ZSTD
+  case Compression::ZSTD:
+    return std::make_unique<ZstdDecoder>();
+#endif
+  default:
+    throw std::runtime_error(
+      std::string("built without ").append(compression_name(c)).append(" support"));
+  }
+}
+
+// replays the bytes which were already read to sniff the format, then continues with the source
+class PrefixedSource : public ByteSource
+{
+  std::unique_ptr<ByteSource> input_;
+  std::string prefix_;
+  size_t pos_ = 0;
+
+public:
+  PrefixedSource(std::unique_ptr<ByteSource> input, std::string prefix)
+    : input_(std::move(input)), prefix_(std::move(prefix))
+  {
+  }
+
+  size_t read(char* dst, size_t size) override
+  {
+    if (pos_ < prefix_.size())
+    {
+      const size_t n = std::min(size, prefix_.size() - pos_);
+      std::memcpy(dst, prefix_.data() + pos_, n);
+      pos_ += n;
+      return n;
+    }
+    return input_->read(dst, size);
+  }
+
+  bool bad() const override { return input_->bad(); }
+};
+
+// decodes on the caller's thread, pulling compressed bytes from `input` as needed
+class DecodingSource : public ByteSource
+{
+  std::unique_ptr<ByteSource> input_;
+  std::unique_ptr<Decoder> decoder_;
+
+public:
+  DecodingSource(std::unique_ptr<ByteSource> input, Compression compression)
+    : input_(std::move(input)), decoder_(make_decoder(compression))
+  {
+  }
+
+  size_t read(char* dst, size_t size) override { return decoder_->decode(*input_, dst, size); }
+  bool bad() const override { return input_->bad(); }
+};
+
+// Decompression runs on its own thread, one block ahead of the scanner: while the scanner
+// consumes one block the worker fills the other one.
+class DecompressingSource : public ReadAheadSource
+{
+public:
+  static constexpr size_t BLOCK_SIZE = 1024 * 1024;
+
+  DecompressingSource(std::unique_ptr<ByteSource> input, Compression compression)
+    : ReadAheadSource(std::make_unique<DecodingSource>(std::move(input), compression), 2,
+                      BLOCK_SIZE)
+  {
+  }
+};
+
+// sniffs the format of `input` and puts a decompressor in front of it when needed
+inline std::unique_ptr<ByteSource> open_decompressed(std::unique_ptr<ByteSource> input,
+                                                     Compression* detected = nullptr)
+{
+  std::string magic(COMPRESSION_MAGIC_SIZE, '\0');
+  size_t size = 0;
+  while (size < magic.size())
+  {
+    const size_t n = input->read(magic.data() + size, magic.size() - size);
+    if (n == 0)
+      break;
+    size += n;
+  }
+  magic.resize(size);
+
+  const Compression compression = detect_compression(magic.data(), magic.size());
+  if (detected)
+    *detected = compression;
+
+  auto prefixed = std::make_unique<PrefixedSource>(std::move(input), std::move(magic));
+  if (compression == Compression::NONE)
+    return prefixed;
+  return std::make_unique<DecompressingSource>(std::move(prefixed), compression);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "parser.h"
+#include "scanner.h"
+#include <stdexcept>
+#include <string_view>
+#include <variant>
+
+// The events carry the SAN of every move, so no move is decoded unless the handler does it; only
+// results are told apart, the parser has to start over after each of them.
+struct ResultOnlyMoves
+{
+  Moves operator()(std::string_view symbol, bool) const
+  {
+    if (is_result_symbol(symbol))
+      return Finish{result_of(symbol)};
+    return Ignore{};
+  }
+};
+
+// Reports every game of the scanner to `events` as the callbacks of BasicPGNParser describe,
+// with no board and no move decoding. A handler without on_comment does not make a streamed
+// scanner keep the bytes of comments.
+template <class Events>
+void parse_pgn(TokenScanner& scanner, Events& events)
+{
+  if constexpr (WantsComments<Events>)
+    scanner.keep_comments();
+
+  BasicPGNParser<ResultOnlyMoves> parser;
+  for (const auto& token : scanner)
+  {
+    auto action = parser.consume_token(token, scanner.text(token), events);
+    if (action && std::holds_alternative<Finish>(*action))
+      parser.reset();
+  }
+
+  if (scanner.is_bad())
+    throw std::runtime_error("failed to read the input");
+}
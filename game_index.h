@@ -0,0 +1,282 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mapped_file.h"
+#include "replay.h"
+#include "scanner.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+struct GameIndexEntry
+{
+  uint64_t offset; // of the first token of the game, same as GameRecord::offset
+  uint32_t length; // up to the end of the result token
+  uint32_t movetext; // first token after the tags, relative to `offset`
+};
+static_assert(sizeof(GameIndexEntry) == 16);
+
+// Layout of the `.idx` sidecar: this header followed by `count` entries in file order. The size
+// and mtime of the PGN file it was built from are kept, so a changed file invalidates it.
+struct GameIndexHeader
+{
+  static constexpr char MAGIC[8] = {'P', 'G', 'N', 'I', 'D', 'X', '\0', '\0'};
+  // 2: a game with no result ends at the tags of the next game
+  static constexpr uint32_t VERSION = 2;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  uint64_t count;
+};
+static_assert(sizeof(GameIndexHeader) % alignof(GameIndexEntry) == 0);
+
+// One pass over the tokens, with no parsing or replay: games are split by GameBoundary, the same
+// as replay_games_lenient resyncs, and the movetext of a game starts with the first token after
+// its tags.
+inline std::vector<GameIndexEntry> build_game_index(const char* begin, const char* end)
+{
+  std::vector<GameIndexEntry> games;
+  TokenScanner scanner(begin, end);
+  std::vector<Token> batch(4096);
+
+  GameIndexEntry game{};
+  GameBoundary boundary;
+  bool in_game = false;
+  bool in_movetext = false;
+  uint64_t last_end = 0;
+  while (size_t n = scanner.next_batch(batch))
+  {
+    for (const Token& token : std::span(batch.data(), n))
+    {
+      if (!in_game)
+      {
+        if (is_skipped_token(token.kind))
+          continue;
+        game = {token.offset, 0, 0};
+        in_game = true;
+        in_movetext = false;
+        boundary.start();
+      }
+
+      const std::string_view text = scanner.text(token);
+      GameBoundary::Step step = boundary.step(token, text);
+      if (step == GameBoundary::NEXT)
+      {
+        // a game with no result, cut at the tags of the next one
+        game.length = static_cast<uint32_t>(last_end - game.offset);
+        games.push_back(game);
+        game = {token.offset, 0, 0};
+        in_movetext = false;
+        boundary.start();
+        step = boundary.step(token, text);
+      }
+      last_end = token.offset + token.length;
+
+      if (!in_movetext && !boundary.in_tag() && token.kind != TokenKind::RightBrace)
+      {
+        in_movetext = true;
+        game.movetext = static_cast<uint32_t>(token.offset - game.offset);
+      }
+      if (step == GameBoundary::LAST)
+      {
+        game.length = static_cast<uint32_t>(last_end - game.offset);
+        games.push_back(game);
+        in_game = false;
+      }
+    }
+  }
+
+  if (scanner.is_bad())
+    throw std::runtime_error("failed to read the input");
+
+  // the last game is kept even when it has no result
+  if (in_game)
+  {
+    game.length = static_cast<uint32_t>(last_end - game.offset);
+    if (!in_movetext)
+      game.movetext = game.length;
+    games.push_back(game);
+  }
+  return games;
+}
+
+// Cuts a file of `file_size` bytes into at most `parts` ranges of about the same number of bytes,
+// each starting at one of `games`; the result starts with 0 and ends with `file_size`.
+inline std::vector<uint64_t> split_games(std::span<const GameIndexEntry> games, size_t parts,
+                                         uint64_t file_size)
+{
+  std::vector<uint64_t> bounds{0};
+  for (size_t i = 1; i < parts; ++i)
+  {
+    const uint64_t target = file_size / parts * i;
+    auto it = std::lower_bound(games.begin(), games.end(), target,
+                               [](const GameIndexEntry& game, uint64_t offset)
+                               { return game.offset < offset; });
+    if (it == games.end())
+      break;
+    if (it->offset > bounds.back())
+      bounds.push_back(it->offset);
+  }
+  bounds.push_back(file_size);
+  return bounds;
+}
+
+// replay_games_parallel with [begin, end) cut into `threads` ranges at the games
+// build_game_index finds, so a tag or a result inside of a comment is never taken for the start
+// of a game. Lexing the input once for that costs little next to replaying it.
+template <class Summarize>
+auto replay_games_parallel(const char* begin, const char* end, size_t threads,
+                           Summarize&& summarize, bool* unfinished = nullptr,
+                           CachingMoveFactory* decode = nullptr)
+{
+  std::vector<const char*> bounds;
+  if (threads > 1)
+  {
+    for (uint64_t offset : split_games(build_game_index(begin, end), threads, end - begin))
+      bounds.push_back(begin + offset);
+  }
+  else
+    bounds = {begin, end};
+  return replay_games_parallel(begin, bounds, std::forward<Summarize>(summarize), unfinished,
+                               decode);
+}
+
+// Offsets of every game of a PGN file, loaded from the `<file>.idx` sidecar when it is still
+// valid and rebuilt and saved next to the file otherwise. A saved index is mapped, not read.
+class GameIndex
+{
+  std::unique_ptr<MappedFile> sidecar_;
+  std::vector<GameIndexEntry> built_;
+  std::span<const GameIndexEntry> games_;
+  bool loaded_ = false;
+
+  struct SourceStat
+  {
+    uint64_t size;
+    int64_t mtime_ns;
+  };
+
+  static SourceStat stat_source(const std::string& path)
+  {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+      throw std::runtime_error(std::string("failed to stat file [").append(path).append("]"));
+    return {static_cast<uint64_t>(st.st_size),
+            static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec};
+  }
+
+  bool load(const std::string& path, SourceStat source)
+  {
+    if (!MappedFile::is_mappable(path))
+      return false;
+
+    auto sidecar = std::make_unique<MappedFile>(path);
+    if (sidecar->size() < sizeof(GameIndexHeader))
+      return false;
+
+    GameIndexHeader header;
+    std::memcpy(&header, sidecar->data(), sizeof(header));
+    if (std::memcmp(header.magic, GameIndexHeader::MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != GameIndexHeader::VERSION ||
+        header.entry_size != sizeof(GameIndexEntry) || header.source_size != source.size ||
+        header.source_mtime_ns != source.mtime_ns ||
+        // a corrupt count must not wrap the size it is checked against
+        header.count > (sidecar->size() - sizeof(GameIndexHeader)) / sizeof(GameIndexEntry) ||
+        sidecar->size() != sizeof(GameIndexHeader) + header.count * sizeof(GameIndexEntry))
+      return false;
+
+    games_ = {reinterpret_cast<const GameIndexEntry*>(sidecar->data() + sizeof(GameIndexHeader)),
+              header.count};
+    sidecar_ = std::move(sidecar);
+    return true;
+  }
+
+  // written under a temporary name and renamed, so readers never see half of an index
+  bool save(const std::string& path, SourceStat source) const
+  {
+    GameIndexHeader header;
+    std::memcpy(header.magic, GameIndexHeader::MAGIC, sizeof(header.magic));
+    header.version = GameIndexHeader::VERSION;
+    header.entry_size = sizeof(GameIndexEntry);
+    header.source_size = source.size;
+    header.source_mtime_ns = source.mtime_ns;
+    header.count = built_.size();
+
+    const std::string tmp_path = path + ".tmp." + std::to_string(::getpid());
+    FILE* file = std::fopen(tmp_path.c_str(), "wb");
+    if (!file)
+      return false;
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(built_.data(), sizeof(GameIndexEntry), built_.size(), file) ==
+                built_.size();
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+public:
+  static std::string sidecar_path(const std::string& pgn_path) { return pgn_path + ".idx"; }
+
+  // `data` has to be the mapped content of `pgn_path`, it is only scanned when no valid
+  // sidecar exists; failing to save the new one (say, a read-only directory) is not an error
+  GameIndex(const std::string& pgn_path, const char* data, size_t size)
+  {
+    const SourceStat source = stat_source(pgn_path);
+    const std::string path = sidecar_path(pgn_path);
+    loaded_ = source.size == size && load(path, source);
+    if (loaded_)
+      return;
+
+    built_ = build_game_index(data, data + size);
+    games_ = built_;
+    if (source.size == size)
+      save(path, source);
+  }
+
+  GameIndex(const GameIndex&) = delete;
+  GameIndex& operator=(const GameIndex&) = delete;
+
+  std::span<const GameIndexEntry> games() const { return games_; }
+  size_t size() const { return games_.size(); }
+  const GameIndexEntry& operator[](size_t i) const { return games_[i]; }
+  bool loaded_from_sidecar() const { return loaded_; }
+
+  // Cuts a file of `file_size` bytes into at most `parts` ranges of about the same number of
+  // bytes, each starting at a game; the result starts with 0 and ends with `file_size`.
+  std::vector<uint64_t> split(size_t parts, uint64_t file_size) const
+  {
+    return split_games(games_, parts, file_size);
+  }
+};
@@ -0,0 +1,183 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "byte_source.h"
+#include "decompress.h"
+#include "generator.h"
+#include "headers.h"
+#include "mapped_file.h"
+#include "parser.h"
+#include "replay.h"
+#include "scanner.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+
+struct PgnMove
+{
+  std::string_view san; // valid until the next move is pulled
+  PackedSan move; // played by ChessBoard::apply as it is
+  uint32_t ply = 0; // 1 for the first move of the game, which is black's from some positions
+  bool white = false; // as the parser tells it from the [FEN] tag and the move numbers
+};
+
+// The game a pgn_games loop is at. Its tags are read by the time it is yielded, its moves are
+// read only as moves() is pulled; whatever is left of the game is skipped when the loop moves on.
+// The object is reused for every game of the input.
+class PgnGame
+{
+  TokenScanner& scanner_;
+  TokenScanner::Iterator token_;
+  BasicPGNParser<CachingMoveFactory> parser_; // the cache is kept for all the games
+  GameHeaders headers_;
+  PgnMove move_;
+  uint64_t offset_ = 0;
+  TerminationMarker result_ = TerminationMarker::MANUAL;
+  bool finished_ = false;
+  bool holding_move_ = false; // the current token is the last move handed out
+
+  friend Generator<PgnGame&> pgn_games(TokenScanner& scanner);
+
+  explicit PgnGame(TokenScanner& scanner) : scanner_(scanner), token_(scanner.begin()) {}
+
+  bool at_end() const { return token_ == scanner_.end(); }
+
+  // skips what is between games and reads the tags, stopping at the first token of the movetext
+  bool start()
+  {
+    while (!at_end() && is_skipped_token(token_->kind))
+      ++token_;
+    if (at_end())
+      return false;
+
+    offset_ = token_->offset;
+    result_ = TerminationMarker::MANUAL;
+    finished_ = false;
+    holding_move_ = false;
+    move_.ply = 0;
+    parser_.reset();
+    headers_.clear();
+    headers_.offset = offset_;
+    TagReader reader;
+    for (; !at_end(); ++token_)
+    {
+      if (!reader.feed(*token_, scanner_.text(*token_), headers_))
+        break;
+    }
+    headers_.movetext = at_end() ? scanner_.bytes_scanned() : token_->offset;
+    if (const TagSpan* fen = headers_.find("FEN"))
+      parser_.set_fen(headers_.raw_value(*fen));
+    return true;
+  }
+
+  // the next move of the main line into move_, false once the result or the input end is read;
+  // the token of the move stays current, so its text is still there while the move is used
+  bool next_move()
+  {
+    if (holding_move_)
+    {
+      holding_move_ = false;
+      ++token_;
+    }
+    for (; !at_end() && !finished_; ++token_)
+    {
+      auto action = parser_.consume_token(*token_, scanner_.text(*token_));
+      if (!action || action->index() == index_of<Ignore>)
+        continue;
+      if (action->index() == index_of<Finish>)
+      {
+        result_ = action->result();
+        finished_ = true;
+        continue;
+      }
+
+      move_.san = scanner_.text(*token_);
+      move_.move = *action;
+      ++move_.ply;
+      move_.white = parser_.side_of_last_move();
+      holding_move_ = true;
+      return true;
+    }
+    return false;
+  }
+
+public:
+  PgnGame(const PgnGame&) = delete;
+  PgnGame& operator=(const PgnGame&) = delete;
+
+  // of the first token of the game, same as GameRecord::offset
+  uint64_t offset() const { return offset_; }
+  const GameHeaders& headers() const { return headers_; }
+
+  // the moves of the main line in order, variations are left out; pulling it again continues
+  // after the last move pulled
+  Generator<const PgnMove&> moves()
+  {
+    while (next_move())
+      co_yield move_;
+  }
+
+  // known once the moves are read to the end
+  bool finished() const { return finished_; }
+  TerminationMarker result() const { return result_; }
+};
+
+// Games of the scanner one at a time, read only as far as the consumer pulls them: nothing but
+// the current game is held and none of the games or moves is allocated.
+//   for (PgnGame& game : pgn_games(scanner))
+//     for (const PgnMove& move : game.moves())
+inline Generator<PgnGame&> pgn_games(TokenScanner& scanner)
+{
+  PgnGame game(scanner);
+  while (game.start())
+  {
+    co_yield game;
+    while (game.next_move())
+      ;
+  }
+  if (scanner.is_bad())
+    throw std::runtime_error("failed to read the input");
+}
+
+// Same for a file: mapped when it is a plain PGN file, streamed and decompressed otherwise. The
+// mapping or the stream lives as long as the generator does.
+inline Generator<PgnGame&> pgn_games(std::string path)
+{
+  std::unique_ptr<MappedFile> mapping;
+  std::unique_ptr<ByteSource> source;
+  std::optional<TokenScanner> scanner;
+  if (MappedFile::is_mappable(path))
+  {
+    mapping = std::make_unique<MappedFile>(path);
+    if (detect_compression(mapping->data(), mapping->size()) == Compression::NONE)
+      scanner.emplace(mapping->data(), mapping->data() + mapping->size());
+  }
+  if (!scanner)
+  {
+    mapping.reset();
+    source = open_decompressed(std::make_unique<FdSource>(path));
+    scanner.emplace(*source);
+  }
+
+  for (PgnGame& game : pgn_games(*scanner))
+    co_yield game;
+}
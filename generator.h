@@ -0,0 +1,171 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Frames of coroutines which are started over and over, such as the moves of every game, are
+// handed back to the next coroutine of the same frame size instead of to the allocator.
+class FrameCache
+{
+  struct Slot
+  {
+    void* block = nullptr;
+    size_t size = 0;
+  };
+  std::array<Slot, 4> slots_;
+
+public:
+  FrameCache() = default;
+  FrameCache(const FrameCache&) = delete;
+  FrameCache& operator=(const FrameCache&) = delete;
+
+  ~FrameCache()
+  {
+    for (Slot& slot : slots_)
+      ::operator delete(slot.block);
+  }
+
+  void* allocate(size_t size)
+  {
+    for (Slot& slot : slots_)
+    {
+      if (slot.block && slot.size == size)
+        return std::exchange(slot.block, nullptr);
+    }
+    return ::operator new(size);
+  }
+
+  void release(void* block, size_t size)
+  {
+    for (Slot& slot : slots_)
+    {
+      if (!slot.block)
+      {
+        slot = {block, size};
+        return;
+      }
+    }
+    ::operator delete(block);
+  }
+
+  static FrameCache& local()
+  {
+    thread_local FrameCache cache;
+    return cache;
+  }
+};
+
+// A lazily evaluated sequence of references, the coroutine runs only while the consumer pulls the
+// next item and each item is whatever object the coroutine yields, nothing is copied or queued.
+// gcc 12 has no std::generator yet, this is the subset of it the repo needs.
+template <class Ref>
+  requires std::is_reference_v<Ref>
+class Generator
+{
+public:
+  struct promise_type
+  {
+    std::add_pointer_t<Ref> value_ = nullptr;
+    std::exception_ptr error_;
+
+    Generator get_return_object()
+    {
+      return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(Ref value) noexcept
+    {
+      value_ = std::addressof(value);
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() { error_ = std::current_exception(); }
+
+    static void* operator new(size_t size) { return FrameCache::local().allocate(size); }
+    static void operator delete(void* frame, size_t size)
+    {
+      FrameCache::local().release(frame, size);
+    }
+  };
+
+  class Iterator
+  {
+    std::coroutine_handle<promise_type> coroutine_;
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::remove_cvref_t<Ref>;
+
+    Iterator() = default;
+    explicit Iterator(std::coroutine_handle<promise_type> coroutine) : coroutine_(coroutine) {}
+
+    Ref operator*() const { return static_cast<Ref>(*coroutine_.promise().value_); }
+    Iterator& operator++()
+    {
+      resume(coroutine_);
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+    bool operator==(std::default_sentinel_t) const { return coroutine_.done(); }
+  };
+
+  Generator(Generator&& other) noexcept : coroutine_(std::exchange(other.coroutine_, {})) {}
+  Generator& operator=(Generator&& other) noexcept
+  {
+    std::swap(coroutine_, other.coroutine_);
+    return *this;
+  }
+  Generator(const Generator&) = delete;
+  Generator& operator=(const Generator&) = delete;
+
+  ~Generator()
+  {
+    if (coroutine_)
+      coroutine_.destroy();
+  }
+
+  // single pass, runs the coroutine up to its first item
+  Iterator begin()
+  {
+    resume(coroutine_);
+    return Iterator(coroutine_);
+  }
+  std::default_sentinel_t end() const { return {}; }
+
+private:
+  std::coroutine_handle<promise_type> coroutine_;
+
+  explicit Generator(std::coroutine_handle<promise_type> coroutine) : coroutine_(coroutine) {}
+
+  static void resume(std::coroutine_handle<promise_type> coroutine)
+  {
+    coroutine.resume();
+    if (coroutine.promise().error_)
+      std::rethrow_exception(std::exchange(coroutine.promise().error_, {}));
+  }
+};
@@ -0,0 +1,425 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner.h"
+#include "simd_scan.h"
+#include "tokens.h"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// A tag as it is in the input: where its name and its value start, quotes excluded and escape
+// sequences still in place, relative to the text the GameHeaders keeps the tags in.
+struct TagSpan
+{
+  uint32_t name;
+  uint32_t value;
+  uint16_t name_length;
+  uint16_t flags; // Token::Flags of the value
+  uint32_t value_length;
+};
+static_assert(sizeof(TagSpan) == 16);
+
+// a Date-like value; 0 stands for a `??` part
+struct TagDate
+{
+  uint16_t year = 0;
+  uint8_t month = 0;
+  uint8_t day = 0;
+};
+
+// Tag pairs of one game, in file order. Only spans are recorded while reading the tags, a value
+// is looked up, unescaped or converted when someone asks for it. The spans point into the mapped
+// input when there is one and into a buffer the raw tags are copied to otherwise. One record is
+// reused for all games, so nothing is allocated once the buffers are big enough.
+class GameHeaders
+{
+  const char* source_ = nullptr;
+  std::string copied_;
+  std::vector<TagSpan> tags_;
+
+  const char* base() const { return source_ ? source_ : copied_.data(); }
+
+  uint32_t keep(std::string_view text)
+  {
+    if (source_)
+      return static_cast<uint32_t>(text.data() - source_);
+    copied_.append(text);
+    return static_cast<uint32_t>(copied_.size() - text.size());
+  }
+
+public:
+  uint64_t offset = 0; // of the `[` opening the first tag
+  uint64_t movetext = 0; // of the first token after the tags
+
+  // `source` is where the tags are read from when it stays valid until the next clear(), null
+  // when the tag text has to be copied
+  void clear(const char* source = nullptr)
+  {
+    source_ = source;
+    copied_.clear();
+    tags_.clear();
+  }
+
+  // name and value are kept as soon as each is read, a streamed window may move on in between
+  void add_name(std::string_view name)
+  {
+    if (name.size() > UINT16_MAX)
+      throw std::runtime_error("tag name is too long");
+    TagSpan tag{};
+    tag.name = keep(name);
+    tag.name_length = static_cast<uint16_t>(name.size());
+    tags_.push_back(tag);
+  }
+  void set_value(std::string_view value, uint8_t flags)
+  {
+    TagSpan& tag = tags_.back();
+    tag.value = keep(value);
+    tag.value_length = static_cast<uint32_t>(value.size());
+    tag.flags = flags;
+  }
+
+  std::span<const TagSpan> tags() const { return tags_; }
+  std::string_view name(const TagSpan& tag) const { return {base() + tag.name, tag.name_length}; }
+  // as it is in the input, escapes included
+  std::string_view raw_value(const TagSpan& tag) const
+  {
+    return {base() + tag.value, tag.value_length};
+  }
+
+  // the first tag with the name, null if there is none
+  const TagSpan* find(std::string_view tag_name) const
+  {
+    for (const TagSpan& tag : tags_)
+    {
+      if (name(tag) == tag_name)
+        return &tag;
+    }
+    return nullptr;
+  }
+
+  // the value with its escapes resolved, which is a view of the input unless it has any; empty
+  // when the game has no such tag
+  std::string_view value(const TagSpan& tag, std::string& scratch) const
+  {
+    Token token;
+    token.flags = static_cast<uint8_t>(tag.flags);
+    return unescape(token, raw_value(tag), scratch);
+  }
+  std::string_view value(std::string_view tag_name, std::string& scratch) const
+  {
+    const TagSpan* tag = find(tag_name);
+    return tag ? value(*tag, scratch) : std::string_view{};
+  }
+
+  // a whole number such as WhiteElo, none for a missing tag, `?`, `-` or anything else
+  std::optional<int64_t> integer(std::string_view tag_name) const
+  {
+    const TagSpan* tag = find(tag_name);
+    if (!tag)
+      return {};
+    const std::string_view raw = raw_value(*tag);
+    int64_t number = 0;
+    auto [end, error] = std::from_chars(raw.data(), raw.data() + raw.size(), number);
+    if (error != std::errc() || end != raw.data() + raw.size())
+      return {};
+    return number;
+  }
+
+  // a `YYYY.MM.DD` value where any part could be question marks, none when it is not one
+  std::optional<TagDate> date(std::string_view tag_name) const
+  {
+    const TagSpan* tag = find(tag_name);
+    if (!tag)
+      return {};
+    const std::string_view raw = raw_value(*tag);
+    if (raw.size() != 10 || raw[4] != '.' || raw[7] != '.')
+      return {};
+
+    auto part = [&raw](size_t at, size_t size, auto& out)
+    {
+      const std::string_view digits = raw.substr(at, size);
+      if (digits.find_first_not_of('?') == std::string_view::npos)
+        return true;
+      unsigned number = 0;
+      auto [end, error] = std::from_chars(digits.data(), digits.data() + size, number);
+      out = static_cast<std::remove_reference_t<decltype(out)>>(number);
+      return error == std::errc() && end == digits.data() + size;
+    };
+    TagDate date;
+    if (!part(0, 4, date.year) || !part(5, 2, date.month) || !part(8, 2, date.day))
+      return {};
+    return date;
+  }
+};
+
+// Walks the tokens of a tag section: `[` Symbol String `]`, as many times as there are tags.
+class TagReader
+{
+  enum Step
+  {
+    LEFT_BRACE,
+    NAME,
+    VALUE,
+    RIGHT_BRACE
+  };
+
+  Step step_ = LEFT_BRACE;
+
+public:
+  // false once the token is not a part of a tag, the tag section is over then
+  bool feed(const Token& token, std::string_view text, GameHeaders& headers)
+  {
+    switch (step_)
+    {
+    case LEFT_BRACE:
+      if (token.kind != TokenKind::LeftBrace)
+        return false;
+      step_ = NAME;
+      return true;
+    case NAME:
+      if (token.kind != TokenKind::Symbol)
+        throw std::runtime_error("tag name expected at offset " + std::to_string(token.offset));
+      headers.add_name(text);
+      step_ = VALUE;
+      return true;
+    case VALUE:
+      if (token.kind != TokenKind::String)
+        throw std::runtime_error("tag value expected at offset " + std::to_string(token.offset));
+      headers.set_value(text, token.flags);
+      step_ = RIGHT_BRACE;
+      return true;
+    case RIGHT_BRACE:
+      if (token.kind != TokenKind::RightBrace)
+        throw std::runtime_error("] expected at offset " + std::to_string(token.offset));
+      step_ = LEFT_BRACE;
+      return true;
+    }
+    return false;
+  }
+
+  bool in_tag() const { return step_ != LEFT_BRACE; }
+};
+
+// Returns the `[` starting the next tag section at or after `p`, or `end`: a `[` at the start of
+// a line which is not inside of a comment. The movetext is not lexed, only brace comments, line
+// comments and escape lines are told apart, so a tag in a comment is not taken for a game.
+inline const char* skip_movetext(const char* p, const char* end)
+{
+  const char* eol = p;
+  while (p < end)
+  {
+    // a line holds many comments, its end is looked up only once
+    if (eol < p || (eol == p && *p != '\n'))
+      eol = find_char(p, end, '\n');
+    const char* brace = static_cast<const char*>(std::memchr(p, '{', eol - p));
+    if (!brace)
+      brace = eol;
+    const char* semicolon = static_cast<const char*>(std::memchr(p, ';', brace - p));
+    if (!semicolon && brace != eol)
+    {
+      // a brace comment may span many lines
+      p = find_char(brace + 1, end, '}');
+      if (p != end)
+        ++p;
+      continue;
+    }
+
+    if (eol == end)
+      return end;
+    p = eol + 1;
+    if (p != end && *p == '[')
+      return p;
+    if (p != end && *p == '%')
+      p = find_char(p, end, '\n');
+  }
+  return end;
+}
+
+// Fast path for a whole file in memory: the tags of each game are lexed and its movetext is
+// jumped over with skip_movetext, with no SAN decoding and no board. Calls
+// on_game(const GameHeaders&) for every tag section; games without tags are not reported.
+template <class OnGame>
+void scan_headers(const char* begin, const char* end, OnGame&& on_game)
+{
+  GameHeaders headers;
+  const char* p = begin;
+  while (p != end)
+  {
+    TokenScanner scanner(p, end);
+    TagReader reader;
+    headers.clear(p);
+    headers.offset = p - begin;
+    headers.movetext = end - begin;
+    bool has_tags = false;
+    const char* movetext = end;
+    for (const auto& token : scanner)
+    {
+      if (!reader.feed(token, scanner.text(token), headers))
+      {
+        headers.movetext = headers.offset + token.offset;
+        movetext = p + token.offset;
+        break;
+      }
+      if (!has_tags)
+      {
+        // leading comments or the movetext of a game without tags
+        has_tags = true;
+        headers.offset += token.offset;
+      }
+    }
+    if (scanner.is_bad())
+      throw std::runtime_error("failed to read the input");
+    if (has_tags)
+      on_game(static_cast<const GameHeaders&>(headers));
+    p = skip_movetext(movetext, end);
+  }
+}
+
+// Same for inputs which can only be streamed: the movetext is still lexed, but its tokens are
+// merely skipped until the next `[`.
+template <class OnGame>
+void scan_headers(TokenScanner& scanner, OnGame&& on_game)
+{
+  GameHeaders headers;
+  TagReader reader;
+  bool in_tags = false;
+  for (const auto& token : scanner)
+  {
+    if (!in_tags)
+    {
+      if (token.kind != TokenKind::LeftBrace)
+        continue;
+      in_tags = true;
+      headers.clear();
+      headers.offset = token.offset;
+    }
+    if (!reader.feed(token, scanner.text(token), headers))
+    {
+      in_tags = false;
+      headers.movetext = token.offset;
+      on_game(static_cast<const GameHeaders&>(headers));
+    }
+  }
+  if (scanner.is_bad())
+    throw std::runtime_error("failed to read the input");
+  if (in_tags)
+  {
+    headers.movetext = scanner.bytes_scanned();
+    on_game(static_cast<const GameHeaders&>(headers));
+  }
+}
+
+// A column of a tag projection: the tag name, optionally suffixed with `:int` or `:date` to have
+// its value converted rather than copied out as it is.
+struct TagColumn
+{
+  enum Kind
+  {
+    TEXT,
+    INTEGER,
+    DATE
+  };
+
+  std::string name;
+  Kind kind = TEXT;
+};
+
+inline const std::vector<TagColumn>& seven_tag_roster()
+{
+  static const std::vector<TagColumn> columns{
+    {"Event"}, {"Site"}, {"Date"}, {"Round"}, {"White"}, {"Black"}, {"Result"}};
+  return columns;
+}
+
+// "WhiteElo:int,BlackElo:int,ECO,Date:date"
+inline std::vector<TagColumn> parse_tag_projection(std::string_view list)
+{
+  std::vector<TagColumn> columns;
+  while (!list.empty())
+  {
+    const size_t comma = list.find(',');
+    std::string_view item = list.substr(0, comma);
+    list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+    TagColumn column;
+    if (const size_t colon = item.find(':'); colon != std::string_view::npos)
+    {
+      const std::string_view kind = item.substr(colon + 1);
+      if (kind == "int")
+        column.kind = TagColumn::INTEGER;
+      else if (kind == "date")
+        column.kind = TagColumn::DATE;
+      else if (kind != "text")
+        throw std::runtime_error(std::string("unknown tag type [").append(kind).append("]"));
+      item = item.substr(0, colon);
+    }
+    if (item.empty())
+      throw std::runtime_error("empty tag name in the tag list");
+    column.name = item;
+    columns.push_back(std::move(column));
+  }
+  return columns;
+}
+
+// Only the projected tags are decoded; a missing tag or a value which does not convert is
+// written as nothing, a date as YYYY-MM-DD with `??` for the unknown parts.
+inline void write_tag(std::ostream& out, const GameHeaders& headers, const TagColumn& column,
+                      std::string& scratch)
+{
+  switch (column.kind)
+  {
+  case TagColumn::TEXT:
+    out << headers.value(column.name, scratch);
+    break;
+  case TagColumn::INTEGER:
+    if (auto number = headers.integer(column.name))
+      out << *number;
+    break;
+  case TagColumn::DATE:
+    if (auto date = headers.date(column.name))
+    {
+      auto part = [&out](unsigned number, int width)
+      {
+        if (number)
+        {
+          const char fill = out.fill('0');
+          out << std::setw(width) << number;
+          out.fill(fill);
+        }
+        else
+          out << std::string_view("????", width);
+      };
+      part(date->year, 4);
+      out << '-';
+      part(date->month, 2);
+      out << '-';
+      part(date->day, 2);
+    }
+    break;
+  }
+}
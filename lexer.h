@@ -0,0 +1,223 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tokens.h"
+#include <array>
+#include <cstdint>
+
+// All token kinds are lexed by one deterministic automaton: every byte is mapped to a ByteClass
+// and the next step is a single lookup in a [LexState][ByteClass] table built at compile time.
+
+enum ByteClass : uint8_t
+{
+  CLASS_SPACE,
+  CLASS_NEW_LINE,
+  CLASS_OTHER_SEPARATOR, // \t \r
+  CLASS_DIGIT,
+  CLASS_LETTER,
+  CLASS_SYMBOL_PUNCT, // non-alphanumeric chars allowed inside a symbol
+  CLASS_QUOTE,
+  CLASS_BACKSLASH,
+  CLASS_LEFT_BRACKET,
+  CLASS_RIGHT_BRACKET,
+  CLASS_LEFT_PARENTHESIS,
+  CLASS_RIGHT_PARENTHESIS,
+  CLASS_PERIOD,
+  CLASS_ASTERISK,
+  CLASS_LEFT_CURLY,
+  CLASS_RIGHT_CURLY,
+  CLASS_DOLLAR,
+  CLASS_SEMICOLON,
+  CLASS_PERCENT,
+  CLASS_PRINTABLE, // anything else allowed inside a string, including utf-8 bytes of tag values
+  CLASS_CONTROL,
+  CLASS_COUNT
+};
+
+enum LexState : uint8_t
+{
+  LEX_START,
+  LEX_INTEGER, // only digits so far, becomes a symbol on the first non-digit
+  LEX_SYMBOL,
+  LEX_STRING,
+  LEX_STRING_ESCAPE,
+  LEX_BRACE_COMMENT,
+  LEX_LINE_COMMENT,
+  LEX_ESCAPE_LINE,
+  LEX_NAG,
+  LEX_STATE_COUNT
+};
+
+enum LexAction : uint8_t
+{
+  LEX_CONTINUE, // consume the byte and move to the next state
+  LEX_SKIP, // same as continue, but the state body is jumped over up to its terminator
+  LEX_EMIT, // consume the byte and emit the token
+  LEX_EMIT_BEFORE, // emit the token, the byte starts the next one
+  LEX_FAIL_START, // byte can not start any token
+  LEX_FAIL_STRING // byte is not allowed inside a string
+};
+
+struct LexTransition
+{
+  LexState next;
+  LexAction action;
+  TokenKind kind;
+};
+
+constexpr std::array<ByteClass, 256> make_byte_classes()
+{
+  std::array<ByteClass, 256> classes{};
+  for (int c = 0; c < 0x20; ++c)
+    classes[c] = CLASS_CONTROL;
+  for (int c = 0x20; c <= 0xff; ++c)
+    classes[c] = CLASS_PRINTABLE;
+  classes[0x7f] = CLASS_CONTROL;
+
+  classes[' '] = CLASS_SPACE;
+  classes['\n'] = CLASS_NEW_LINE;
+  classes['\t'] = classes['\r'] = CLASS_OTHER_SEPARATOR;
+  for (int c = '0'; c <= '9'; ++c)
+    classes[c] = CLASS_DIGIT;
+  for (int c = 'a'; c <= 'z'; ++c)
+    classes[c] = CLASS_LETTER;
+  for (int c = 'A'; c <= 'Z'; ++c)
+    classes[c] = CLASS_LETTER;
+  for (unsigned char c : {':', '-', '_', '+', '=', '#', '/'})
+    classes[c] = CLASS_SYMBOL_PUNCT;
+  classes['\"'] = CLASS_QUOTE;
+  classes['\\'] = CLASS_BACKSLASH;
+  classes['['] = CLASS_LEFT_BRACKET;
+  classes[']'] = CLASS_RIGHT_BRACKET;
+  classes['('] = CLASS_LEFT_PARENTHESIS;
+  classes[')'] = CLASS_RIGHT_PARENTHESIS;
+  classes['.'] = CLASS_PERIOD;
+  classes['*'] = CLASS_ASTERISK;
+  classes['{'] = CLASS_LEFT_CURLY;
+  classes['}'] = CLASS_RIGHT_CURLY;
+  classes['$'] = CLASS_DOLLAR;
+  classes[';'] = CLASS_SEMICOLON;
+  classes['%'] = CLASS_PERCENT;
+  return classes;
+}
+
+using LexTable = std::array<std::array<LexTransition, CLASS_COUNT>, LEX_STATE_COUNT>;
+
+constexpr LexTable make_lex_table()
+{
+  LexTable table{};
+  auto row = [&](LexState state, LexTransition fallback)
+  {
+    for (auto& t : table[state])
+      t = fallback;
+    return &table[state];
+  };
+
+  // separator runs are skipped before the automaton starts, so START never sees them
+  auto* start = row(LEX_START, {LEX_START, LEX_FAIL_START, TokenKind::None});
+  (*start)[CLASS_LEFT_BRACKET] = {LEX_START, LEX_EMIT, TokenKind::LeftBrace};
+  (*start)[CLASS_RIGHT_BRACKET] = {LEX_START, LEX_EMIT, TokenKind::RightBrace};
+  (*start)[CLASS_LEFT_PARENTHESIS] = {LEX_START, LEX_EMIT, TokenKind::LeftParenthesis};
+  (*start)[CLASS_RIGHT_PARENTHESIS] = {LEX_START, LEX_EMIT, TokenKind::RightParenthesis};
+  (*start)[CLASS_PERIOD] = {LEX_START, LEX_EMIT, TokenKind::Period};
+  (*start)[CLASS_ASTERISK] = {LEX_START, LEX_EMIT, TokenKind::Asterisk};
+  (*start)[CLASS_QUOTE] = {LEX_STRING, LEX_CONTINUE, TokenKind::None};
+  (*start)[CLASS_LEFT_CURLY] = {LEX_BRACE_COMMENT, LEX_SKIP, TokenKind::None};
+  (*start)[CLASS_SEMICOLON] = {LEX_LINE_COMMENT, LEX_SKIP, TokenKind::None};
+  (*start)[CLASS_PERCENT] = {LEX_ESCAPE_LINE, LEX_SKIP, TokenKind::None};
+  (*start)[CLASS_DOLLAR] = {LEX_NAG, LEX_CONTINUE, TokenKind::None};
+  (*start)[CLASS_DIGIT] = {LEX_INTEGER, LEX_CONTINUE, TokenKind::None};
+  (*start)[CLASS_LETTER] = {LEX_SYMBOL, LEX_CONTINUE, TokenKind::None};
+
+  auto* integer = row(LEX_INTEGER, {LEX_START, LEX_EMIT_BEFORE, TokenKind::Integer});
+  (*integer)[CLASS_DIGIT] = {LEX_INTEGER, LEX_CONTINUE, TokenKind::None};
+  (*integer)[CLASS_LETTER] = {LEX_SYMBOL, LEX_CONTINUE, TokenKind::None};
+  (*integer)[CLASS_SYMBOL_PUNCT] = {LEX_SYMBOL, LEX_CONTINUE, TokenKind::None};
+
+  auto* symbol = row(LEX_SYMBOL, {LEX_START, LEX_EMIT_BEFORE, TokenKind::Symbol});
+  (*symbol)[CLASS_DIGIT] = {LEX_SYMBOL, LEX_CONTINUE, TokenKind::None};
+  (*symbol)[CLASS_LETTER] = {LEX_SYMBOL, LEX_CONTINUE, TokenKind::None};
+  (*symbol)[CLASS_SYMBOL_PUNCT] = {LEX_SYMBOL, LEX_CONTINUE, TokenKind::None};
+
+  // every printable char including space is part of the string
+  auto* string = row(LEX_STRING, {LEX_STRING, LEX_CONTINUE, TokenKind::None});
+  (*string)[CLASS_QUOTE] = {LEX_START, LEX_EMIT, TokenKind::String};
+  (*string)[CLASS_BACKSLASH] = {LEX_STRING_ESCAPE, LEX_CONTINUE, TokenKind::None};
+  (*string)[CLASS_NEW_LINE] = {LEX_START, LEX_FAIL_STRING, TokenKind::None};
+  (*string)[CLASS_OTHER_SEPARATOR] = {LEX_START, LEX_FAIL_STRING, TokenKind::None};
+  (*string)[CLASS_CONTROL] = {LEX_START, LEX_FAIL_STRING, TokenKind::None};
+
+  // only quote and backslash itself could be escaped
+  auto* escape = row(LEX_STRING_ESCAPE, {LEX_START, LEX_FAIL_STRING, TokenKind::None});
+  (*escape)[CLASS_QUOTE] = {LEX_STRING, LEX_CONTINUE, TokenKind::None};
+  (*escape)[CLASS_BACKSLASH] = {LEX_STRING, LEX_CONTINUE, TokenKind::None};
+
+  auto* brace_comment = row(LEX_BRACE_COMMENT, {LEX_BRACE_COMMENT, LEX_SKIP, TokenKind::None});
+  (*brace_comment)[CLASS_RIGHT_CURLY] = {LEX_START, LEX_EMIT, TokenKind::BraceComment};
+
+  auto* line_comment = row(LEX_LINE_COMMENT, {LEX_LINE_COMMENT, LEX_SKIP, TokenKind::None});
+  (*line_comment)[CLASS_NEW_LINE] = {LEX_START, LEX_EMIT, TokenKind::LineComment};
+
+  auto* escape_line = row(LEX_ESCAPE_LINE, {LEX_ESCAPE_LINE, LEX_SKIP, TokenKind::None});
+  (*escape_line)[CLASS_NEW_LINE] = {LEX_START, LEX_EMIT, TokenKind::Escape};
+
+  auto* nag = row(LEX_NAG, {LEX_START, LEX_EMIT_BEFORE, TokenKind::NumericGlyph});
+  (*nag)[CLASS_DIGIT] = {LEX_NAG, LEX_CONTINUE, TokenKind::None};
+
+  return table;
+}
+
+inline constexpr std::array<ByteClass, 256> byte_classes = make_byte_classes();
+inline constexpr LexTable lex_table = make_lex_table();
+
+// states whose body is jumped over with find_char instead of being stepped byte by byte
+constexpr bool is_skip_state(LexState state)
+{
+  return state == LEX_BRACE_COMMENT || state == LEX_LINE_COMMENT || state == LEX_ESCAPE_LINE;
+}
+
+// the byte that ends the body of a skip state
+constexpr char skip_terminator(LexState state)
+{
+  return state == LEX_BRACE_COMMENT ? '}' : '\n';
+}
+
+// what a state completes to when the input ends inside of it; None means the token is cut off
+constexpr TokenKind lex_eof_kind(LexState state)
+{
+  switch (state)
+  {
+  case LEX_INTEGER:
+    return TokenKind::Integer;
+  case LEX_SYMBOL:
+    return TokenKind::Symbol;
+  case LEX_NAG:
+    return TokenKind::NumericGlyph;
+  case LEX_LINE_COMMENT:
+    return TokenKind::LineComment;
+  case LEX_ESCAPE_LINE:
+    return TokenKind::Escape;
+  default:
+    return TokenKind::None;
+  }
+}
+
+inline const LexTransition& lex_step(LexState state, char c)
+{
+  return lex_table[state][byte_classes[static_cast<unsigned char>(c)]];
+}
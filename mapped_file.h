@@ -0,0 +1,89 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read-only mapping of a whole regular file, so the scanner can walk it as a plain char range
+class MappedFile
+{
+  int fd_ = -1;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+
+public:
+  explicit MappedFile(const std::string& path)
+  {
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0)
+    {
+      throw std::runtime_error(std::string("failed to open file [").append(path).append("]"));
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      ::close(fd_);
+      throw std::runtime_error(std::string("not a regular file [").append(path).append("]"));
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0)
+    {
+      // empty files can not be mapped, so they simply stay as an empty range
+      void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (addr == MAP_FAILED)
+      {
+        ::close(fd_);
+        throw std::runtime_error(std::string("failed to mmap file [")
+                                   .append(path)
+                                   .append("]: ")
+                                   .append(std::strerror(errno)));
+      }
+
+      ::madvise(addr, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(addr);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile()
+  {
+    if (data_)
+      ::munmap(const_cast<char*>(data_), size_);
+    if (fd_ >= 0)
+      ::close(fd_);
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // pipes, fifos and character devices can not be mapped, so those have to go via istream
+  static bool is_mappable(const std::string& path)
+  {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+  }
+};
@@ -0,0 +1,335 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "board.h"
+#include "events.h"
+#include "parser.h"
+#include "replay.h"
+#include "scanner.h"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+struct MoveNode
+{
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  uint32_t san = 0; // into the text of the tree
+  uint16_t san_length = 0;
+  bool white = false;
+  uint32_t next = NONE; // the move after this one on the same line
+  uint32_t variation = NONE; // the first line played instead of this move
+  uint32_t sibling = NONE; // the next line played instead of the same move as this line
+  uint32_t annotations = NONE; // the first comment or NAG of the move
+};
+
+// A comment or a NAG of a move. A comment is kept as the span of its text in the input, it is
+// never copied: resolve it with MoveTree::text against the same input the tree was read from.
+struct Annotation
+{
+  enum Kind : uint8_t
+  {
+    COMMENT,
+    NAG
+  };
+
+  uint64_t offset = 0; // of the comment text, delimiters excluded
+  uint32_t length = 0;
+  Kind kind = COMMENT;
+  bool before = false; // opens the line ahead of the move rather than following it
+  uint16_t nag = 0;
+  uint32_t next = MoveNode::NONE; // the next annotation of the same move
+};
+
+// The moves of a game with all of its variations (RAV). Nodes link to each other by index and
+// live in one vector, the SAN of all of them in one string, so a tree reused for game after game
+// stops allocating once it has seen its biggest game.
+class MoveTree
+{
+  std::vector<MoveNode> nodes_;
+  std::vector<Annotation> annotations_;
+  std::string text_;
+  uint32_t root_ = MoveNode::NONE;
+
+public:
+  void clear()
+  {
+    nodes_.clear();
+    annotations_.clear();
+    text_.clear();
+    root_ = MoveNode::NONE;
+  }
+
+  uint32_t add(std::string_view san, bool white)
+  {
+    if (san.size() > UINT16_MAX)
+      throw std::runtime_error("move is too long");
+    MoveNode node;
+    node.san = static_cast<uint32_t>(text_.size());
+    node.san_length = static_cast<uint16_t>(san.size());
+    node.white = white;
+    text_.append(san);
+    nodes_.push_back(node);
+    return static_cast<uint32_t>(nodes_.size() - 1);
+  }
+
+  // the first move of the main line
+  uint32_t root() const { return root_; }
+  void set_root(uint32_t node) { root_ = node; }
+
+  size_t size() const { return nodes_.size(); }
+  MoveNode& operator[](uint32_t node) { return nodes_[node]; }
+  const MoveNode& operator[](uint32_t node) const { return nodes_[node]; }
+  std::string_view san(const MoveNode& node) const
+  {
+    return std::string_view(text_).substr(node.san, node.san_length);
+  }
+
+  uint32_t add(const Annotation& annotation)
+  {
+    annotations_.push_back(annotation);
+    return static_cast<uint32_t>(annotations_.size() - 1);
+  }
+  Annotation& annotation(uint32_t index) { return annotations_[index]; }
+  const Annotation& annotation(uint32_t index) const { return annotations_[index]; }
+  size_t annotation_count() const { return annotations_.size(); }
+
+  // calls f(const Annotation&) for the comments and NAGs of the move in file order
+  template <class F>
+  void for_each_annotation(const MoveNode& node, F&& f) const
+  {
+    for (uint32_t i = node.annotations; i != MoveNode::NONE; i = annotations_[i].next)
+      f(annotations_[i]);
+  }
+
+  // `input` is the start of what the tree was read from, say the mapped file
+  static std::string_view text(const Annotation& annotation, const char* input)
+  {
+    return {input + annotation.offset, annotation.length};
+  }
+};
+
+// Grows a MoveTree from the events of the parser. A variation hangs off the last move of the line
+// it is opened in, the one it is played instead of; a variation before any move of its line has
+// nothing to replace and is left out. With `Annotate` comments and NAGs are attached to the move
+// they follow, or to the first move of their line when they open it; without it the builder has
+// no such callbacks, so the parser does not even look at them.
+template <bool Annotate>
+class BasicMoveTreeBuilder
+{
+  struct Line
+  {
+    uint32_t last = MoveNode::NONE;
+    uint32_t branch = MoveNode::NONE; // the move the line is played instead of
+    uint32_t pending = MoveNode::NONE; // annotations ahead of the first move of the line
+  };
+
+  MoveTree& tree_;
+  std::vector<Line> lines_; // the open ones, the main line first
+  uint32_t plies_ = 0;
+  uint64_t base_offset_ = 0;
+
+  // appends the chain starting at `first` to the annotations at `head`
+  void link(uint32_t& head, uint32_t first)
+  {
+    uint32_t* tail = &head;
+    while (*tail != MoveNode::NONE)
+      tail = &tree_.annotation(*tail).next;
+    *tail = first;
+  }
+
+  void annotate(Annotation annotation)
+  {
+    Line& line = lines_.back();
+    annotation.before = line.last == MoveNode::NONE;
+    const uint32_t index = tree_.add(annotation);
+    link(annotation.before ? line.pending : tree_[line.last].annotations, index);
+  }
+
+public:
+  // `base_offset` is added to the offsets of comments, as it is to those of the games
+  explicit BasicMoveTreeBuilder(MoveTree& tree, uint64_t base_offset = 0)
+    : tree_(tree), base_offset_(base_offset)
+  {
+    start();
+  }
+
+  void start()
+  {
+    tree_.clear();
+    lines_.assign(1, {});
+    plies_ = 0;
+  }
+
+  // moves of the main line so far
+  uint32_t plies() const { return plies_; }
+
+  void on_move(std::string_view san, bool white, unsigned)
+  {
+    Line& line = lines_.back();
+    if (line.last == MoveNode::NONE && line.branch == MoveNode::NONE && lines_.size() > 1)
+      return;
+    plies_ += lines_.size() == 1;
+
+    const uint32_t node = tree_.add(san, white);
+    if (line.last != MoveNode::NONE)
+      tree_[line.last].next = node;
+    else if (line.branch != MoveNode::NONE)
+    {
+      uint32_t* link = &tree_[line.branch].variation;
+      while (*link != MoveNode::NONE)
+        link = &tree_[*link].sibling;
+      *link = node;
+    }
+    else
+      tree_.set_root(node);
+    line.last = node;
+
+    if constexpr (Annotate)
+    {
+      tree_[node].annotations = std::exchange(line.pending, MoveNode::NONE);
+    }
+  }
+
+  void on_variation_begin() { lines_.push_back({MoveNode::NONE, lines_.back().last}); }
+  void on_variation_end()
+  {
+    if (lines_.size() > 1)
+      lines_.pop_back();
+  }
+
+  void on_comment(std::string_view text, uint64_t offset)
+    requires Annotate
+  {
+    Annotation annotation;
+    annotation.offset = base_offset_ + offset;
+    annotation.length = static_cast<uint32_t>(text.size());
+    annotate(annotation);
+  }
+
+  void on_nag(unsigned nag)
+    requires Annotate
+  {
+    Annotation annotation;
+    annotation.kind = Annotation::NAG;
+    annotation.nag = static_cast<uint16_t>(nag);
+    annotate(annotation);
+  }
+};
+
+using MoveTreeBuilder = BasicMoveTreeBuilder<false>;
+using AnnotatedMoveTreeBuilder = BasicMoveTreeBuilder<true>;
+
+namespace detail
+{
+template <class OnMove>
+void replay_line(const MoveTree& tree, uint32_t first, unsigned depth, ChessBoard& board,
+                 OnMove& on_move)
+{
+  const MoveFactory decode;
+  for (uint32_t node = first; node != MoveNode::NONE; node = tree[node].next)
+  {
+    const MoveNode& move = tree[node];
+    if (move.variation != MoveNode::NONE)
+    {
+      // every variation starts from the position before the move, which the journal gets back to
+      const size_t before = board.mark();
+      for (uint32_t line = move.variation; line != MoveNode::NONE; line = tree[line].sibling)
+      {
+        replay_line(tree, line, depth + 1, board, on_move);
+        board.undo(before);
+      }
+    }
+
+    const std::string_view san = tree.san(move);
+    board.apply(decode(san, move.white));
+    on_move(move, san, static_cast<const ChessBoard&>(board), depth);
+    // no line branches off before this point any more
+    if (depth == 0)
+      board.drop_journal();
+  }
+}
+} // namespace detail
+
+// Plays every line of the tree on `board`, which has to be at the position before the first
+// move, calling on_move(const MoveNode&, std::string_view san, const ChessBoard&, unsigned depth)
+// after each move; depth 0 is the main line. The board ends at the last position of the main line
+// with no copy of it ever made, a variation is started from its branch point by undoing the moves
+// played since.
+template <class OnMove>
+void replay_tree(const MoveTree& tree, ChessBoard& board, OnMove&& on_move)
+{
+  board.set_journaling(true);
+  try
+  {
+    detail::replay_line(tree, tree.root(), 0, board, on_move);
+  }
+  catch (...)
+  {
+    board.set_journaling(false);
+    throw;
+  }
+  board.set_journaling(false);
+}
+
+// Reads every game of the scanner into `tree`, variations included, and calls
+// on_game(const GameRecord&, const MoveTree&) once its result is read; GameRecord::plies counts
+// the main line only. With `Annotate` the comments and NAGs of the moves are kept as well, which
+// makes a streamed scanner keep the bytes of comments in its window. Returns whether the input
+// ended in the middle of a game.
+template <bool Annotate = false, class OnGame>
+bool read_move_trees(TokenScanner& scanner, uint64_t base_offset, MoveTree& tree, OnGame&& on_game)
+{
+  BasicMoveTreeBuilder<Annotate> builder(tree, base_offset);
+  if constexpr (Annotate)
+    scanner.keep_comments();
+  BasicPGNParser<ResultOnlyMoves> parser;
+  GameRecord record;
+  bool in_game = false;
+  for (const auto& token : scanner)
+  {
+    if (!in_game)
+    {
+      if (is_skipped_token(token.kind))
+        continue;
+      in_game = true;
+      record = {base_offset + token.offset, 0, TerminationMarker::MANUAL};
+      builder.start();
+    }
+
+    auto action = parser.consume_token(token, scanner.text(token), builder);
+    if (!action)
+      continue;
+    if (const Finish* finish = std::get_if<Finish>(&*action))
+    {
+      record.result = finish->marker;
+      record.plies = builder.plies();
+      on_game(static_cast<const GameRecord&>(record), static_cast<const MoveTree&>(tree));
+      parser.reset();
+      in_game = false;
+    }
+  }
+
+  if (scanner.is_bad())
+    throw std::runtime_error("failed to read the input");
+  return in_game;
+}
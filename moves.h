@@ -19,14 +19,15 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <variant>
 
-inline auto& all_possible_pieces()
+constexpr bool is_piece_letter(char c)
 {
-  static std::unordered_set<char> pieces{'P', 'N', 'B', 'R', 'Q', 'K'};
-  return pieces;
+  return c == 'P' || c == 'N' || c == 'B' || c == 'R' || c == 'Q' || c == 'K';
 }
 
 enum class TerminationMarker
@@ -60,7 +61,7 @@ struct NextMove
   Coordinates src;
   Coordinates dst;
   std::optional<char> promote_piece;
-  std::string orig_token;
+  std::string orig_token; // empty unless decoded by TokenKeepingMoveFactory
 };
 
 struct KingCastling
@@ -82,14 +83,261 @@ struct Ignore
 {
 };
 
-using Moves = std::variant<KingCastling, QueenCastling, NextMove, Finish, Ignore>;
+// A move written with both of its squares, in UCI (e2e4, e7e8q) or long algebraic notation
+// (Ng1-f3, e2-e4, e4xd5), played from the source square as is rather than looked for. The squares are
+// x * 8 + y of the board, rank 8 first; a king moving two files or onto a rook of its own is a
+// castling.
+struct LongMove
+{
+  uint8_t from = 0;
+  uint8_t to = 0;
+  char piece = '\0'; // as written, UCI leaves it out
+  char promote_piece = '\0';
+  bool is_white_move = false;
+  bool capture = false; // written with an x, which the board then has to find a capture
+};
+
+using Moves = std::variant<KingCastling, QueenCastling, NextMove, Finish, Ignore, LongMove>;
+
+// the index of an alternative of Moves, as Moves::index() gives it
+template <class Move>
+inline constexpr size_t index_of = []<size_t... I>(std::index_sequence<I...>)
+{
+  return ((std::is_same_v<Move, std::variant_alternative_t<I, Moves>> ? I : 0) + ...);
+}(std::make_index_sequence<std::variant_size_v<Moves>>());
+
+// Piece letters as 3 bit codes, 0 being no piece.
+constexpr uint32_t piece_code(char piece)
+{
+  switch (piece)
+  {
+  case 'P':
+    return 1;
+  case 'N':
+    return 2;
+  case 'B':
+    return 3;
+  case 'R':
+    return 4;
+  case 'Q':
+    return 5;
+  case 'K':
+    return 6;
+  default:
+    return 0;
+  }
+}
+
+constexpr char piece_letter(uint32_t code)
+{
+  return code >= 1 && code <= 6 ? "PNBRQK"[code - 1] : '\0';
+}
+
+// A decoded SAN in 4 bytes instead of the sizeof(Moves), 88 bytes with GCC on x86-64, to keep the
+// moves of games in flat arrays. From the lowest bit: the index of the Moves alternative (3),
+// white (1), piece (3), promotion (3), the rank and the file of the source and of the destination
+// (4 each, the coordinate + 1, 0 when the SAN leaves it out), capture, check and checkmate (1
+// each) and the result of a Finish (2). Only the token of the move is lost, and the check of a
+// LongMove which keeps none either, see pack() and unpack().
+class PackedSan
+{
+  uint32_t bits_ = 0;
+
+  static constexpr uint32_t KIND = 0, WHITE = 3, PIECE = 4, PROMOTION = 7, SRC_X = 10,
+                            SRC_Y = 14, DST_X = 18, DST_Y = 22, CAPTURE = 26, CHECK = 27,
+                            CHECKMATE = 28, RESULT = 29;
+
+  constexpr uint32_t field(uint32_t shift, uint32_t width) const
+  {
+    return (bits_ >> shift) & ((1u << width) - 1);
+  }
+  constexpr void set(uint32_t shift, uint32_t value) { bits_ |= value << shift; }
+  static constexpr uint32_t coordinate(const std::optional<int>& c) { return c ? *c + 1 : 0; }
+  static constexpr std::optional<int> coordinate(uint32_t c)
+  {
+    return c ? std::optional<int>(c - 1) : std::nullopt;
+  }
+
+  friend constexpr PackedSan pack(const Moves& move);
+  friend inline Moves unpack(PackedSan move);
+
+public:
+  constexpr PackedSan() = default;
+
+  constexpr size_t index() const { return field(KIND, 3); } // same as Moves::index()
+  constexpr bool white() const { return field(WHITE, 1); }
+  // the fields of a NextMove or a LongMove, for the board to play the move with no unpacking
+  constexpr char piece() const { return piece_letter(field(PIECE, 3)); }
+  constexpr char promotion() const { return piece_letter(field(PROMOTION, 3)); }
+  constexpr bool capture() const { return field(CAPTURE, 1); }
+  Coordinates src() const { return {coordinate(field(SRC_X, 4)), coordinate(field(SRC_Y, 4))}; }
+  Coordinates dst() const { return {coordinate(field(DST_X, 4)), coordinate(field(DST_Y, 4))}; }
+  // of a Finish
+  constexpr TerminationMarker result() const
+  {
+    return static_cast<TerminationMarker>(field(RESULT, 2));
+  }
+  // the same move of the other side, castlings and moves only
+  constexpr PackedSan with_white(bool white) const
+  {
+    PackedSan move = *this;
+    if (index() <= 2 || index() == 5)
+      move.bits_ = (bits_ & ~(1u << WHITE)) | uint32_t(white) << WHITE;
+    return move;
+  }
+  constexpr uint32_t bits() const { return bits_; }
+  constexpr bool operator==(const PackedSan&) const = default;
+};
+
+static_assert(sizeof(PackedSan) == 4);
+
+constexpr PackedSan pack(const Moves& move)
+{
+  PackedSan packed;
+  packed.set(PackedSan::KIND, static_cast<uint32_t>(move.index()));
+  std::visit(
+    overloaded{[&](const NextMove& v)
+               {
+                 packed.set(PackedSan::WHITE, v.is_white_move);
+                 packed.set(PackedSan::PIECE, piece_code(v.piece));
+                 if (v.promote_piece)
+                   packed.set(PackedSan::PROMOTION, piece_code(*v.promote_piece));
+                 packed.set(PackedSan::SRC_X, PackedSan::coordinate(v.src.x));
+                 packed.set(PackedSan::SRC_Y, PackedSan::coordinate(v.src.y));
+                 packed.set(PackedSan::DST_X, PackedSan::coordinate(v.dst.x));
+                 packed.set(PackedSan::DST_Y, PackedSan::coordinate(v.dst.y));
+                 packed.set(PackedSan::CAPTURE, v.capture);
+                 packed.set(PackedSan::CHECK, v.check);
+                 packed.set(PackedSan::CHECKMATE, v.checkmate);
+               },
+               [&](const KingCastling& v) { packed.set(PackedSan::WHITE, v.is_white_move); },
+               [&](const QueenCastling& v) { packed.set(PackedSan::WHITE, v.is_white_move); },
+               [&](const Finish& v)
+               { packed.set(PackedSan::RESULT, static_cast<uint32_t>(v.marker)); },
+               [&](const Ignore&) {},
+               [&](const LongMove& v)
+               {
+                 packed.set(PackedSan::WHITE, v.is_white_move);
+                 packed.set(PackedSan::PIECE, piece_code(v.piece));
+                 packed.set(PackedSan::PROMOTION, piece_code(v.promote_piece));
+                 packed.set(PackedSan::SRC_X, v.from / 8u + 1);
+                 packed.set(PackedSan::SRC_Y, v.from % 8u + 1);
+                 packed.set(PackedSan::DST_X, v.to / 8u + 1);
+                 packed.set(PackedSan::DST_Y, v.to % 8u + 1);
+                 packed.set(PackedSan::CAPTURE, v.capture);
+               }},
+    move);
+  return packed;
+}
+
+inline Moves unpack(PackedSan move)
+{
+  switch (move.index())
+  {
+  case 0:
+    return KingCastling{move.white()};
+  case 1:
+    return QueenCastling{move.white()};
+  case 2:
+  {
+    NextMove next;
+    next.piece = piece_letter(move.field(PackedSan::PIECE, 3));
+    next.is_white_move = move.white();
+    next.capture = move.field(PackedSan::CAPTURE, 1);
+    next.check = move.field(PackedSan::CHECK, 1);
+    next.checkmate = move.field(PackedSan::CHECKMATE, 1);
+    next.src = {PackedSan::coordinate(move.field(PackedSan::SRC_X, 4)),
+                PackedSan::coordinate(move.field(PackedSan::SRC_Y, 4))};
+    next.dst = {PackedSan::coordinate(move.field(PackedSan::DST_X, 4)),
+                PackedSan::coordinate(move.field(PackedSan::DST_Y, 4))};
+    if (const uint32_t promotion = move.field(PackedSan::PROMOTION, 3))
+      next.promote_piece = piece_letter(promotion);
+    return next;
+  }
+  case 3:
+    return Finish{static_cast<TerminationMarker>(move.field(PackedSan::RESULT, 2))};
+  case 5:
+  {
+    auto square = [&](uint32_t x, uint32_t y)
+    { return static_cast<uint8_t>((move.field(x, 4) - 1) * 8 + move.field(y, 4) - 1); };
+    LongMove next;
+    next.from = square(PackedSan::SRC_X, PackedSan::SRC_Y);
+    next.to = square(PackedSan::DST_X, PackedSan::DST_Y);
+    next.piece = piece_letter(move.field(PackedSan::PIECE, 3));
+    next.promote_piece = piece_letter(move.field(PackedSan::PROMOTION, 3));
+    next.is_white_move = move.white();
+    next.capture = move.field(PackedSan::CAPTURE, 1);
+    return next;
+  }
+  default:
+    return Ignore{};
+  }
+}
+
+// A move as it was played on the board in 16 bits: the source and the destination squares (6
+// each, rank 8 first the same as the board rows), the promotion piece code (3) and whether it is
+// a castling (1), given with the squares of the king.
+class PackedMove
+{
+  uint16_t bits_ = 0;
+
+public:
+  constexpr PackedMove() = default;
+  constexpr PackedMove(unsigned from, unsigned to, char promotion = '\0', bool castling = false)
+    : bits_(static_cast<uint16_t>(from | to << 6 | piece_code(promotion) << 12 | castling << 15))
+  {
+  }
+
+  constexpr unsigned from() const { return bits_ & 63; }
+  constexpr unsigned to() const { return (bits_ >> 6) & 63; }
+  constexpr char promotion() const { return piece_letter((bits_ >> 12) & 7); }
+  constexpr bool castling() const { return bits_ >> 15; }
+  constexpr uint16_t bits() const { return bits_; }
+  constexpr bool operator==(const PackedMove&) const = default;
+};
+
+static_assert(sizeof(PackedMove) == 2);
+
+// the move in UCI notation, e2e4 or e7e8q
+inline std::ostream& operator<<(std::ostream& o, PackedMove move)
+{
+  auto square = [&](unsigned s) { o << char('a' + s % 8) << char('8' - s / 8); };
+  square(move.from());
+  square(move.to());
+  if (move.promotion())
+    o << char(move.promotion() - 'A' + 'a');
+  return o;
+}
 
 inline std::ostream& operator<<(std::ostream& o, const Moves& val)
 {
   std::visit(
     overloaded{[&](const KingCastling& v) { o << v.is_white_move; },
                [&](const QueenCastling& v) { o << v.is_white_move; },
-               [&](const NextMove& v) { o << v.orig_token; }, [&](const Ignore& v) { o << "ignore"; },
+               [&](const NextMove& v)
+               {
+                 if (!v.orig_token.empty())
+                 {
+                   o << v.orig_token;
+                   return;
+                 }
+                 // spelled out from what was decoded, the token was not kept
+                 o << v.piece;
+                 if (v.src.y)
+                   o << char('a' + *v.src.y);
+                 if (v.src.x)
+                   o << char('8' - *v.src.x);
+                 if (v.capture)
+                   o << 'x';
+                 if (v.dst.y)
+                   o << char('a' + *v.dst.y);
+                 if (v.dst.x)
+                   o << char('8' - *v.dst.x);
+                 if (v.promote_piece)
+                   o << '=' << *v.promote_piece;
+               },
+               [&](const LongMove& v) { o << PackedMove(v.from, v.to, v.promote_piece); },
+               [&](const Ignore& v) { o << "ignore"; },
                [&](const Finish& v) { o << (size_t)v.marker; }},
     val);
   return o;
@@ -19,20 +19,23 @@
 #include "common.h"
 #include "moves.h"
 #include "tokens.h"
+#include <array>
 #include <assert.h>
 #include <bits/ranges_cmp.h>
-#include <functional>
-#include <memory>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
 #include <optional>
 #include <ranges>
 #include <sstream>
+#include <string>
 #include <stdexcept>
+#include <string_view>
 #include <type_traits>
-#include <typeindex>
-#include <typeinfo>
-#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <variant>
+#include <vector>
 
 enum class State
 {
@@ -47,324 +50,718 @@ enum class State
   ParsingLeftParenthesis,
   ParsingRightParenthesis,
   ParsingComment,
-  Finished
+  Finished,
+  Invalid, // no transition
+  Count
 };
 
-struct MoveFactory
+inline constexpr size_t STATE_COUNT = static_cast<size_t>(State::Count);
+
+// Decodes the SAN of a move from the view of its token, with no allocation: the special tokens
+// are told apart by their length and first byte. The token is copied into NextMove::orig_token
+// only with KeepToken, for whoever wants to print the moves back.
+template <bool KeepToken>
+struct BasicMoveFactory
 {
+  Moves operator()(std::string_view val, bool white_turn) const
+  {
+    return (*this)(val, white_turn, nullptr);
+  }
 
-  Moves operator()(const std::string& val, bool white_turn) const
+  // with `error` given, a symbol which is no move gives Ignore and the reason in `error` instead
+  // of an exception
+  Moves operator()(std::string_view val, bool white_turn, std::string* error) const
   {
-    if (std::ranges::equal(val, std::string{"e"}) || std::ranges::equal(val, std::string{"p"}))
+    auto fail = [&](const char* reason) -> Moves
     {
-      // no need to capture 'en passant' capture as it is implicitly derived anyway
+      if (!error)
+        throw std::runtime_error(std::string(reason).append(begin(val), end(val)));
+      error->assign(reason).append(begin(val), end(val));
       return Ignore{};
-    }
-    if (std::ranges::equal(val, std::string{"O-O"}))
-    {
-      return KingCastling{white_turn};
-    }
-    else if (std::ranges::equal(val, std::string{"O-O-O"}))
-    {
-      return QueenCastling{white_turn};
-    }
-    else if (std::ranges::equal(val, std::string{"1-0"}))
-    {
-      return Finish{TerminationMarker::WHITE_WON};
-    }
-    else if (std::ranges::equal(val, std::string{"0-1"}))
+    };
+
+    switch (val.size())
     {
-      return Finish{TerminationMarker::BLAKC_WON};
+    case 1:
+      // no need to capture 'en passant' capture as it is implicitly derived anyway
+      if (val[0] == 'e' || val[0] == 'p')
+        return Ignore{};
+      break;
+    case 3:
+      switch (val[0])
+      {
+      case 'O':
+        if (val == "O-O")
+          return KingCastling{white_turn};
+        break;
+      case '1':
+        if (val == "1-0")
+          return Finish{TerminationMarker::WHITE_WON};
+        break;
+      case '0':
+        if (val == "0-1")
+          return Finish{TerminationMarker::BLAKC_WON};
+        break;
+      }
+      break;
+    case 5:
+      if (val == "O-O-O")
+        return QueenCastling{white_turn};
+      break;
+    case 7:
+      if (val == "1/2-1/2")
+        return Finish{TerminationMarker::EVEN};
+      break;
     }
-    else if (std::ranges::equal(val, std::string{"1/2-1/2"}))
+
+    // both squares written out, nothing for the board to look for
+    if (LongMove long_move; could_be_long(val) && decode_long(val, white_turn, long_move))
+      return long_move;
+
+    // regular move!
+    NextMove next_move;
+    if constexpr (KeepToken)
+      next_move.orig_token = val;
+    auto c = rbegin(val);
+    auto has_more_char = [&val, &c]() { return (rend(val) != c); };
+    const char* const too_short = "bad symbol val to pare next move: ";
+
+    // is_white_move
     {
-      return Finish{TerminationMarker::EVEN};
+      next_move.is_white_move = white_turn;
     }
-    else
-    {
-      // regular move!
-      NextMove next_move;
-      next_move.orig_token = val;
-      auto c = rbegin(val);
-      auto needs_one_char = [&val, &c]()
-      {
-        if (rend(val) == c)
-        {
-          throw std::runtime_error(
-            std::string("bad symbol val to pare next move: ").append(begin(val), end(val)));
-        }
-      };
-      auto has_more_char = [&val, &c]() { return (rend(val) != c); };
 
-      // is_white_move
+    // try to identify checkmate / ':' capture / check
+    // could be potentialy up to 2 of these special moves
+    for (size_t i = 1; i <= 2; ++i)
+    {
+      if (!has_more_char())
+        return fail(too_short);
+      if (*c == '#')
       {
-        next_move.is_white_move = white_turn;
+        next_move.checkmate = true;
+        ++c;
       }
-
-      // try to identify checkmate / ':' capture / check
-      // could be potentialy up to 2 of these special moves
-      for (size_t i = 1; i <= 2; ++i)
+      else if (*c == '+')
       {
-        needs_one_char();
-        if (*c == '#')
-        {
-          next_move.checkmate = true;
-          ++c;
-        }
-        else if (*c == '+')
-        {
-          next_move.check = true;
-          ++c;
-        }
-        else if (*c == ':')
-        {
-          next_move.capture = true;
-          ++c;
-        }
-        else
-        {
-          break;
-        }
+        next_move.check = true;
+        ++c;
       }
-
-      if (*c == ')')
+      else if (*c == ':')
       {
-        // another way of indicating a promotion
+        next_move.capture = true;
         ++c;
-        needs_one_char();
       }
-
-      if (all_possible_pieces().find(*c) != end(all_possible_pieces()))
+      else
       {
-        // promotion!
-        next_move.promote_piece = *c;
-        ++c;
-
-        needs_one_char();
-        if (*c == '=' || *c == '/' || *c == '(')
-          ++c;
+        break;
       }
+    }
 
-      // to
-      {
-        if (has_more_char() && '1' <= *c && '8' >= *c) // if *src* rank provided
-        {
-          next_move.dst.x = r(*c);
-          ++c;
-        }
+    if (!has_more_char())
+      return fail(too_short);
+    if (*c == ')')
+    {
+      // another way of indicating a promotion
+      ++c;
+      if (!has_more_char())
+        return fail(too_short);
+    }
 
-        if (has_more_char() && 'a' <= *c && 'h' >= *c) // if *src* file provided
-        {
-          next_move.dst.y = f(*c);
-          ++c;
-        }
-      }
+    if (is_piece_letter(*c))
+    {
+      // promotion!
+      next_move.promote_piece = *c;
+      ++c;
 
       if (!has_more_char())
+        return fail(too_short);
+      if (*c == '=' || *c == '/' || *c == '(')
+        ++c;
+    }
+
+    // to
+    {
+      if (has_more_char() && '1' <= *c && '8' >= *c) // if *src* rank provided
       {
-        // this is a pawn move
-        next_move.piece = 'P';
-        return next_move;
+        next_move.dst.x = r(*c);
+        ++c;
       }
 
-      if (*c == 'x' || *c == ':')
+      if (has_more_char() && 'a' <= *c && 'h' >= *c) // if *src* file provided
       {
-        next_move.capture = true;
+        next_move.dst.y = f(*c);
         ++c;
       }
+    }
+
+    if (!has_more_char())
+    {
+      // this is a pawn move
+      next_move.piece = 'P';
+      return next_move;
+    }
+
+    if (*c == 'x' || *c == ':')
+    {
+      next_move.capture = true;
+      ++c;
+    }
 
-      // from_row/from_y
+    // from_row/from_y
+    {
+      if (has_more_char() && '1' <= *c && '8' >= *c) // if *src* rank provided
       {
-        if ('1' <= *c && '8' >= *c) // if *src* rank provided
-        {
-          next_move.src.x = r(*c);
-          ++c;
-        }
-        if (has_more_char() && 'a' <= *c && 'h' >= *c) // if *src* file provided
-        {
-          next_move.src.y = f(*c);
-          ++c;
-        }
+        next_move.src.x = r(*c);
+        ++c;
       }
+      if (has_more_char() && 'a' <= *c && 'h' >= *c) // if *src* file provided
+      {
+        next_move.src.y = f(*c);
+        ++c;
+      }
+    }
 
-      if (has_more_char())
+    if (has_more_char())
+    {
+      // actual explicit non-pawn piece
+      if (is_piece_letter(*c))
       {
-        // actual explicit non-pawn piece
-        if (all_possible_pieces().find(*c) != end(all_possible_pieces()))
-        {
-          next_move.piece = *c;
-          ++c;
-        }
-        else
-        {
-          throw std::runtime_error(
-            std::string("was expecting a piece - bad symbol in next move: ").append(begin(val), end(val)));
-        }
+        next_move.piece = *c;
+        ++c;
       }
       else
       {
-        // pawn is an implicit piece
-        next_move.piece = 'P';
+        return fail("was expecting a piece - bad symbol in next move: ");
       }
+    }
+    else
+    {
+      // pawn is an implicit piece
+      next_move.piece = 'P';
+    }
 
-      if (has_more_char())
-      {
-        throw std::runtime_error(
-          std::string("was NOT expecting a piece - extra symbols in next move: ").append(begin(val), end(val)));
-      }
-      return next_move;
+    if (has_more_char())
+    {
+      return fail("was NOT expecting a piece - extra symbols in next move: ");
+    }
+    return next_move;
+  }
+  // A long move starts with its source square, after the piece if any, and has at least 4 bytes,
+  // so the SANs which are no long move (e4, Nf3, exd5, Nbd7, R1e2) are told by their first bytes
+  // and never parsed as one.
+  static constexpr bool could_be_long(std::string_view val)
+  {
+    auto square_at = [&](size_t i)
+    { return val[i] >= 'a' && val[i] <= 'h' && val[i + 1] >= '1' && val[i + 1] <= '8'; };
+    return val.size() >= 4 && (square_at(0) || (is_piece_letter(val[0]) && square_at(1)));
+  }
+
+  // [piece] file rank [- x] file rank [=] [promotion] [+ #], UCI being the same with no piece and
+  // a lower case promotion. A capture written with both squares, e4xd5 or Ng1xf3, is read as a
+  // long move as well, which the board checks captures.
+  static bool decode_long(std::string_view val, bool white_turn, LongMove& move)
+  {
+    const char* p = val.data();
+    const char* end = p + val.size();
+    while (end > p && (end[-1] == '+' || end[-1] == '#'))
+      --end;
+    auto square = [&](uint8_t& s)
+    {
+      if (end - p < 2 || p[0] < 'a' || p[0] > 'h' || p[1] < '1' || p[1] > '8')
+        return false;
+      s = static_cast<uint8_t>(r(p[1]) * 8 + f(p[0]));
+      p += 2;
+      return true;
+    };
+
+    if (p < end && is_piece_letter(*p))
+      move.piece = *p++;
+    if (!square(move.from))
+      return false;
+    if (p < end && (*p == '-' || *p == 'x' || *p == ':'))
+      move.capture = *p++ != '-';
+    if (!square(move.to))
+      return false;
+    if (p < end && *p == '=')
+      ++p;
+    if (p < end)
+    {
+      const char promotion = *p >= 'a' && *p <= 'z' ? char(*p - 'a' + 'A') : *p;
+      if (!is_piece_letter(promotion) || promotion == 'P' || promotion == 'K')
+        return false;
+      move.promote_piece = promotion;
+      ++p;
+    }
+    move.is_white_move = white_turn;
+    return p == end;
+  }
+};
+
+using MoveFactory = BasicMoveFactory<false>;
+using TokenKeepingMoveFactory = BasicMoveFactory<true>;
+
+// MoveFactory giving the move packed, for a parser whose moves go to flat arrays and are played
+// from there
+struct PackingMoveFactory
+{
+  PackedSan operator()(std::string_view val, bool white_turn, std::string* error = nullptr) const
+  {
+    return pack(MoveFactory()(val, white_turn, error));
+  }
+};
+
+// MoveFactory behind a table from the bytes of a token to its decoded move packed with no side,
+// as a game dump has only a few thousand distinct SANs repeated over and over. A token of up to 8
+// bytes is its own key, longer ones and symbols which are no moves are always decoded. 2048 sets
+// of two 16 byte entries stay in the L2 cache; a set keeps the two tokens it saw last, so a pair
+// of frequent tokens falling into one set does not evict each other on every move.
+// Moves are handed out packed, for a parser to pass on to the board as they are: unpacking a hit
+// into Moves would cost about as much as the decoding itself.
+class CachingMoveFactory
+{
+  struct Entry
+  {
+    uint64_t key = 0; // 0 is a free slot, see key_of()
+    PackedSan move;
+  };
+  static constexpr unsigned SET_BITS = 11;
+
+  std::vector<Entry> table_ = std::vector<Entry>(size_t(2) << SET_BITS);
+  uint64_t lookups_ = 0;
+  uint64_t hits_ = 0;
+
+  // The bytes of a token of up to 8 ASCII characters with its size in their unused top bits, 0
+  // for any other. Read as two overlapping words or three bytes rather than copied byte by byte,
+  // the size alone tells where they overlap.
+  static uint64_t key_of(std::string_view val)
+  {
+    const char* p = val.data();
+    const size_t size = val.size();
+    if (size == 0 || size > sizeof(uint64_t))
+      return 0;
+    uint64_t key;
+    if (size >= 4)
+    {
+      uint32_t low, high;
+      std::memcpy(&low, p, 4);
+      std::memcpy(&high, p + size - 4, 4);
+      key = low | uint64_t(high) << 32;
+    }
+    else
+    {
+      key = uint64_t(uint8_t(p[0])) | uint64_t(uint8_t(p[size / 2])) << 8 |
+            uint64_t(uint8_t(p[size - 1])) << 16;
+    }
+    if (key & 0x8080808080808080ull)
+      return 0;
+    const uint64_t bits = size - 1;
+    return key | (bits & 1) << 47 | (bits >> 1 & 1) << 55 | (bits >> 2) << 63;
+  }
+
+public:
+  // the same as PackingMoveFactory, with an `error` as MoveFactory
+  PackedSan operator()(std::string_view val, bool white_turn, std::string* error = nullptr)
+  {
+    ++lookups_;
+    const uint64_t key = key_of(val);
+    if (key == 0)
+      return pack(MoveFactory()(val, white_turn, error));
+
+    Entry* set = &table_[((key * 0x9E3779B97F4A7C15ull) >> (64 - SET_BITS)) * 2];
+    if (set[0].key == key)
+    {
+      ++hits_;
+      return set[0].move.with_white(white_turn);
+    }
+    if (set[1].key == key)
+    {
+      ++hits_;
+      std::swap(set[0], set[1]);
+      return set[0].move.with_white(white_turn);
+    }
+
+    std::string reason;
+    const PackedSan move = pack(MoveFactory()(val, white_turn, error ? &reason : nullptr));
+    if (error && !reason.empty())
+    {
+      *error = std::move(reason);
+      return move;
     }
+    set[1] = set[0];
+    set[0] = {key, move};
+    return move;
+  }
+
+  uint64_t lookups() const { return lookups_; }
+  uint64_t hits() const { return hits_; }
+  double hit_rate() const { return lookups_ ? double(hits_) / double(lookups_) : 0.0; }
+  // counts the lookups of another cache as well, for the caches of a parallel replay
+  void add_counts(const CachingMoveFactory& other)
+  {
+    lookups_ += other.lookups_;
+    hits_ += other.hits_;
   }
 };
 
-class PGNParser
+constexpr bool is_result_symbol(std::string_view symbol)
 {
-  struct status
+  return symbol == "1-0" || symbol == "0-1" || symbol == "1/2-1/2";
+}
+
+// the halves of an `e.p.` written after an en passant capture, which lexes as `e` `.` `p` `.`
+constexpr bool is_en_passant_suffix(std::string_view symbol)
+{
+  return symbol == "e" || symbol == "p";
+}
+
+constexpr TerminationMarker result_of(std::string_view symbol)
+{
+  return symbol == "1-0"   ? TerminationMarker::WHITE_WON
+         : symbol == "0-1" ? TerminationMarker::BLAKC_WON
+                           : TerminationMarker::EVEN;
+}
+
+using ParserTable = std::array<std::array<State, TOKEN_KIND_COUNT>, STATE_COUNT>;
+
+// The automaton of the parser as a [State][TokenKind] table built at compile time, so a
+// transition is a single load and all parsers share it. Comments, NAGs and parentheses never
+// reach the table, consume_token handles those before.
+constexpr ParserTable make_parser_table()
+{
+  ParserTable table{};
+  for (auto& row : table)
+    row.fill(State::Invalid);
+  auto on = [&](State from, TokenKind event, State to)
+  { table[static_cast<size_t>(from)][static_cast<size_t>(event)] = to; };
+
+  on(State::Init, TokenKind::LeftBrace, State::ParsingLeftBracket);
+  on(State::ParsingLeftBracket, TokenKind::Symbol, State::ParsingHeaderName);
+  on(State::ParsingHeaderName, TokenKind::String, State::ParsingHeaderValue);
+  on(State::ParsingHeaderValue, TokenKind::RightBrace, State::ParsingRightBracket);
+  // header loop as many headers can provided!
+  on(State::ParsingRightBracket, TokenKind::LeftBrace, State::ParsingLeftBracket);
+  on(State::ParsingRightBracket, TokenKind::Integer, State::ParsingNumberIndication);
+  on(State::ParsingRightBracket, TokenKind::Symbol, State::ParsingMove);
+
+  on(State::Init, TokenKind::Integer, State::ParsingNumberIndication);
+  on(State::ParsingNumberIndication, TokenKind::Period, State::ParsingPeriod);
+  // self-loop is possible to ensure many periods can be chained
+  on(State::ParsingPeriod, TokenKind::Period, State::ParsingPeriod);
+  on(State::ParsingPeriod, TokenKind::Symbol, State::ParsingMove);
+  on(State::ParsingNumberIndication, TokenKind::Symbol, State::ParsingMove);
+
+  on(State::Init, TokenKind::Symbol, State::ParsingMove);
+  on(State::ParsingMove, TokenKind::Symbol, State::ParsingMove);
+  on(State::ParsingMove, TokenKind::Integer, State::ParsingNumberIndication);
+
+  // Terminating states
+  for (State from : {State::Init, State::ParsingHeaderName, State::ParsingHeaderValue,
+                     State::ParsingRightBracket, State::ParsingMove, State::ParsingNumberIndication,
+                     State::ParsingPeriod, State::ParsingLeftParenthesis,
+                     State::ParsingRightParenthesis, State::ParsingComment})
+    on(from, TokenKind::Asterisk, State::Finished);
+  return table;
+}
+
+inline constexpr ParserTable parser_table = make_parser_table();
+
+// the states with no transition out of them, so telling them costs a load as well
+constexpr std::array<bool, STATE_COUNT> make_final_states()
+{
+  std::array<bool, STATE_COUNT> final_states{};
+  for (size_t state = 0; state < STATE_COUNT; ++state)
   {
-    std::unique_ptr<std::function<Moves(const std::string&)>> emit_move;
-    std::unordered_map<std::type_index /*event*/, State /*target state*/> transitions;
+    final_states[state] = true;
+    for (State to : parser_table[state])
+      final_states[state] = final_states[state] && to == State::Invalid;
+  }
+  return final_states;
+}
+
+inline constexpr std::array<bool, STATE_COUNT> parser_final_states = make_final_states();
+static_assert(parser_final_states[static_cast<size_t>(State::Finished)]);
+
+// What the parser does with the symbol of every move, picked at compile time so the call is
+// direct and could be inlined: Moves operator()(std::string_view symbol, bool white_turn), or the
+// same giving a PackedSan for the parser to hand out packed moves.
+template <class Handler>
+concept MoveHandler =
+  requires(Handler& handler, std::string_view symbol, bool white_turn) {
+    { handler(symbol, white_turn) } -> std::convertible_to<Moves>;
+  } || requires(Handler& handler, std::string_view symbol, bool white_turn) {
+    { handler(symbol, white_turn) } -> std::same_as<PackedSan>;
   };
 
-  std::unordered_map<State, status> automaton_;
+// Events reported to the handler passed to consume_token. Each callback is optional, whatever a
+// handler does not define is compiled out together with the work which feeds it:
+//   on_tag(std::string_view name, std::string_view value), the value unescaped
+//   on_move(std::string_view san, bool white, unsigned depth), depth 0 being the main line
+//   on_comment(std::string_view text) or on_comment(std::string_view text, uint64_t offset),
+//     the offset of the text in the input; a streamed scanner needs keep_comments() on for either
+//   on_nag(unsigned nag)
+//   on_variation_begin(), on_variation_end()
+//   on_result(TerminationMarker), `*` giving MANUAL
+struct NoEvents
+{
+};
+
+template <class Events>
+concept WantsComments =
+  requires(Events& events, std::string_view text) { events.on_comment(text); } ||
+  requires(Events& events, std::string_view text, uint64_t offset) {
+    events.on_comment(text, offset);
+  };
+
+template <MoveHandler Handler>
+class BasicPGNParser
+{
+public:
+  // what consume_token hands out, packed when the handler packs
+  using Move = std::conditional_t<
+    std::is_same_v<std::invoke_result_t<Handler&, std::string_view, bool>, PackedSan>, PackedSan,
+    Moves>;
+
+private:
+  [[no_unique_address]] Handler emit_move_;
   State state_{State::Init};
   int paranthesis_count_{0};
   bool white_turn = false;
+  // the side to move is told by a [FEN] tag and by a move number followed by three periods
+  bool fen_tag_ = false;
+  uint8_t periods_ = 0;
+  // only used by handlers with on_tag or on_move
+  std::string tag_name_;
+  std::string scratch_;
+  std::vector<bool> variation_turns_; // side of the last move of each open variation
+  // a lenient parser reports a malformed game through error() instead of an exception
+  bool lenient_ = false;
+  std::string error_;
 
 public:
-  PGNParser()
+  BasicPGNParser() = default;
+  // a Handler which is a reference, CachingMoveFactory& say, leaves the handler to the caller
+  explicit BasicPGNParser(Handler handler) : emit_move_(std::forward<Handler>(handler)) {}
+
+  // back to the state before the first game, so one parser can replay a whole file
+  void reset()
   {
-    auto& init_status = automaton_[State::Init];
-    init_status.transitions.emplace(LeftBraceToken::Event, State::ParsingLeftBracket);
+    state_ = State::Init;
+    paranthesis_count_ = 0;
+    white_turn = false;
+    fen_tag_ = false;
+    periods_ = 0;
+    variation_turns_.clear();
+    error_.clear();
+  }
+
+  // With lenient on, a token which does not fit the game, a symbol which is no move and bytes a
+  // lenient scanner could not lex make consume_token return nothing and leave the reason in
+  // error() rather than throw. The game could not go on after that, reset() before the next one.
+  void set_lenient(bool lenient = true) { lenient_ = lenient; }
+  bool failed() const { return !error_.empty(); }
+  const std::string& error() const { return error_; }
+
+  // the side to move of a [FEN] tag, for a caller which reads the tags of the game itself
+  void set_fen(std::string_view fen) { white_turn = fen_black_to_move(fen); }
+
+  // true when the last move handed out, or the last of the open variation, is white's
+  bool side_of_last_move() const
+  {
+    return variation_turns_.empty() ? white_turn : variation_turns_.back();
+  }
+
+  std::optional<Move> consume_token(const Token& token, std::string_view text)
+  {
+    NoEvents none;
+    return consume_token(token, text, none);
+  }
+
+  template <class Events>
+  std::optional<Move> consume_token(const Token& token, std::string_view text, Events& events)
+  {
+    const TokenKind event = token.kind;
+    switch (event)
     {
-      auto& brace_open_status = automaton_[State::ParsingLeftBracket];
-      brace_open_status.transitions.emplace(SymbolToken::Event, State::ParsingHeaderName);
+    case TokenKind::None:
+      if (lenient_)
+        return fail("no token", text);
+      INTERNAL_ASSERT(false);
+      return {};
+    // skip some dummy tokens!
+    case TokenKind::BraceComment:
+    case TokenKind::LineComment:
+      if constexpr (requires { events.on_comment(text, token.offset); })
       {
-        auto& header_name_status = automaton_[State::ParsingHeaderName];
-        header_name_status.transitions.emplace(StringToken::Event, State::ParsingHeaderValue);
-        {
-          auto& header_value_status = automaton_[State::ParsingHeaderValue];
-          header_value_status.transitions.emplace(RightBraceToken::Event, State::ParsingRightBracket);
-          {
-            auto& brace_close_status = automaton_[State::ParsingRightBracket];
-            brace_close_status.transitions.emplace(LeftBraceToken::Event, State::ParsingLeftBracket); // header loop as many headers can provided!
-            brace_close_status.transitions.emplace(IntegerToken::Event, State::ParsingNumberIndication); // will define transitions for ParsingNumberIndication below
-            brace_close_status.transitions.emplace(
-              SymbolToken::Event, State::ParsingMove); // will define transitions for ParsingMove below
-          }
-        }
+        const std::string_view comment = comment_text(token, text);
+        events.on_comment(comment, token.offset + (comment.data() - text.data()));
       }
+      else if constexpr (requires { events.on_comment(text); })
+        events.on_comment(comment_text(token, text));
+      return {};
+    case TokenKind::Escape:
+      return {};
+    case TokenKind::NumericGlyph:
+      if constexpr (requires { events.on_nag(0u); })
+        events.on_nag(static_cast<unsigned>(token.number));
+      return {};
+    case TokenKind::LeftParenthesis:
+      ++paranthesis_count_;
+      if constexpr (requires { events.on_move(text, true, 0u); })
+      {
+        // the variation replaces the last move, so its first move is of the same side
+        variation_turns_.push_back(!side_of_last_move());
+      }
+      if constexpr (requires { events.on_variation_begin(); })
+        events.on_variation_begin();
+      return {};
+    case TokenKind::RightParenthesis:
+      if (lenient_ && paranthesis_count_ == 0)
+        return fail("unbalanced parenthesis", text);
+      --paranthesis_count_;
+      if constexpr (requires { events.on_move(text, true, 0u); })
+      {
+        if (!variation_turns_.empty())
+          variation_turns_.pop_back();
+      }
+      if constexpr (requires { events.on_variation_end(); })
+        events.on_variation_end();
+      return {};
+    case TokenKind::Invalid:
+      if (lenient_)
+        return fail("malformed token", text);
+      break;
+    default:
+      break;
     }
+    INTERNAL_ASSERT(paranthesis_count_ >= 0);
 
-    init_status.transitions.emplace(IntegerToken::Event, State::ParsingNumberIndication);
+    // a game ended by a result has to be reset before the next one
+    if (parser_final_states[static_cast<size_t>(state_)])
     {
-      auto& number_indication_status = automaton_[State::ParsingNumberIndication];
-      number_indication_status.transitions.emplace(PeriodToken::Event, State::ParsingPeriod);
-      {
-        auto& period_status = automaton_[State::ParsingPeriod];
-        period_status.transitions.emplace(
-          PeriodToken::Event, State::ParsingPeriod); // self-loop is possible to ensure many periods can be chained
-        period_status.transitions.emplace(SymbolToken::Event, State::ParsingMove);
-      }
-      number_indication_status.transitions.emplace(SymbolToken::Event, State::ParsingMove); // will handle white move below
+      if (lenient_)
+        return fail("token after the result", text);
+      INTERNAL_ASSERT(false);
+    }
+    const State next = parser_table[static_cast<size_t>(state_)][static_cast<size_t>(event)];
+    if (next == State::Invalid)
+    {
+      // let's allow periods after parsing move
+      if (state_ == State::ParsingMove && event == TokenKind::Period)
+        return {};
+
+      std::stringstream ss;
+      ss << "event[" << token_kind_name(event) << "] ";
+      ss << "cannot transition to any knownwn state ";
+      ss << "from state [" << (size_t)state_ << "]";
+      if (lenient_)
+        return fail(ss.str(), text);
+      throw std::runtime_error(ss.str());
+    }
+
+    // a variation could not end the game
+    if (paranthesis_count_ > 0 &&
+        (next == State::Finished || (next == State::ParsingMove && is_result_symbol(text))))
+    {
+      if (lenient_)
+        return fail("result inside of a variation", text);
+      throw std::runtime_error("result inside of a variation at [" + std::string(text) + "]");
+    }
+
+    state_ = next;
+    if (state_ == State::ParsingHeaderName)
+      fen_tag_ = text == "FEN";
+    else if (state_ == State::ParsingHeaderValue && fen_tag_)
+      set_fen(text);
+    else if (state_ == State::ParsingNumberIndication)
+      periods_ = 0;
+    else if (state_ == State::ParsingPeriod)
+      ++periods_;
+    if constexpr (requires { events.on_tag(text, text); })
+    {
+      // the name may be gone from a streamed window by the time of the value
+      if (state_ == State::ParsingHeaderName)
+        tag_name_.assign(text);
+      else if (state_ == State::ParsingHeaderValue)
+        events.on_tag(std::string_view(tag_name_), unescape(token, text, scratch_));
     }
 
-    init_status.transitions.emplace(SymbolToken::Event, State::ParsingMove);
+    if (state_ == State::Finished)
     {
-      auto& move_status = automaton_[State::ParsingMove];
-      move_status.emit_move = std::make_unique<std::function<Moves(const std::string&)>>(
-        [this](const std::string& val)
+      if constexpr (requires { events.on_result(TerminationMarker::MANUAL); })
+        events.on_result(TerminationMarker::MANUAL);
+      return as_move(Finish());
+    }
+
+    if (state_ == State::ParsingMove)
+    {
+      // `12...` numbers a move of black, as the first move of a game from a position may be
+      const bool black_numbered = std::exchange(periods_, 0) >= 3;
+      // no ply of its own, so neither an event nor a turn
+      if (is_en_passant_suffix(text))
+        return paranthesis_count_ > 0 ? std::optional<Move>() : as_move(Ignore{});
+      if (paranthesis_count_ > 0)
+      {
+        if constexpr (requires { events.on_move(text, true, 0u); })
         {
-          this->white_turn = !this->white_turn;
-          Moves current = MoveFactory()(val, this->white_turn);
-          return current;
-        });
-      move_status.transitions.emplace(SymbolToken::Event, State::ParsingMove);
-      move_status.transitions.emplace(IntegerToken::Event, State::ParsingNumberIndication);
-      // move_status.transitions.emplace(PeriodToken::Event, State::ParsingPeriod);
+          if (!variation_turns_.empty())
+          {
+            const bool white = variation_turns_.back() = !variation_turns_.back();
+            events.on_move(text, white, static_cast<unsigned>(paranthesis_count_));
+          }
+        }
+        return {};
+      }
+      if (black_numbered)
+        white_turn = true;
+      white_turn = !white_turn;
+      if constexpr (requires { events.on_result(TerminationMarker::MANUAL); })
+      {
+        if (is_result_symbol(text))
+          events.on_result(result_of(text));
+      }
+      if constexpr (requires { events.on_move(text, true, 0u); })
+      {
+        if (!is_result_symbol(text))
+          events.on_move(text, white_turn, 0u);
+      }
+      if constexpr (requires(std::string* error) { emit_move_(text, white_turn, error); })
+      {
+        if (lenient_)
+        {
+          Move move = emit_move_(text, white_turn, &error_);
+          if (failed())
+            return {};
+          return move;
+        }
+      }
+      return emit_move_(text, white_turn);
     }
 
-    // Terminating states
-    automaton_[State::Init].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingHeaderName].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingHeaderValue].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingRightBracket].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingMove].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingNumberIndication].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingPeriod].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingLeftParenthesis].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingRightParenthesis].transitions.emplace(AsterkixToken::Event, State::Finished);
-    automaton_[State::ParsingComment].transitions.emplace(AsterkixToken::Event, State::Finished);
+    return {};
   }
 
-  std::optional<Moves> consume_token(const Token& token)
+private:
+  static Move as_move(const Moves& move)
   {
-    return std::visit(overloaded{[](const std::monostate&) -> std::optional<Moves>
-                                 {
-                                   INTERNAL_ASSERT(false);
-                                   return {};
-                                 },
-                                 [&](const auto& t) -> std::optional<Moves>
-                                 {
-                                   using token_type = std::decay_t<decltype(t)>;
-                                   auto event = token_type::Event;
-                                   // skip some dummy tokens!
-                                   if (event == BraceComment::Event || event == LineComment::Event ||
-                                       event == EscapeToken::Event || event == NumericGlyphToken::Event)
-                                   {
-                                     return {};
-                                   }
-
-                                   if (event == LeftParenthesisToken::Event)
-                                   {
-                                     ++paranthesis_count_;
-                                     return {};
-                                   }
-                                   if (event == RightParenthesisToken::Event)
-                                   {
-                                     --paranthesis_count_;
-                                     return {};
-                                   }
-                                   INTERNAL_ASSERT(paranthesis_count_ >= 0);
-
-                                   auto& state = automaton_[state_];
-                                   INTERNAL_ASSERT(!state.transitions.empty());
-                                   auto possible_it = state.transitions.find(event);
-                                   if (possible_it == end(state.transitions))
-                                   {
-                                     // let's allow periods after parsing move
-                                     if (state_ == State::ParsingMove && event == PeriodToken::Event)
-                                       return {};
-
-                                     std::stringstream ss;
-                                     ss << "event[" << typeid(token_type).name() << "] ";
-                                     ss << "cannot transition to any knownwn state ";
-                                     ss << "from state [" << (size_t)state_ << "]";
-                                     throw std::runtime_error(ss.str());
-                                   }
-                                   else
-                                   {
-                                     state_ = possible_it->second;
-                                     auto new_state_it = automaton_.find(state_);
-                                     if (state_ == State::Finished)
-                                     {
-                                       return paranthesis_count_ > 0 ? std::optional<Moves>{} : Finish();
-                                     }
-
-                                     INTERNAL_ASSERT(new_state_it != end(automaton_));
-                                     if (state_ == State::ParsingMove && new_state_it->second.emit_move)
-                                     {
-                                       if constexpr (requires { t.value_; })
-                                       {
-                                         return paranthesis_count_ > 0
-                                           ? std::optional<Moves>{}
-                                           : (*new_state_it->second.emit_move)(t.value_);
-                                       }
-                                     }
-                                   }
-
-                                   return {};
-                                 }},
-                      token);
+    if constexpr (std::is_same_v<Move, PackedSan>)
+      return pack(move);
+    else
+      return move;
+  }
+
+  std::optional<Move> fail(std::string_view reason, std::string_view text)
+  {
+    error_.assign(reason).append(" at [").append(text).append("]");
     return {};
   }
+
+  // the active color is the field after the placement of the pieces
+  static bool fen_black_to_move(std::string_view fen)
+  {
+    const size_t space = fen.find(' ');
+    return space != std::string_view::npos && space + 1 < fen.size() && fen[space + 1] == 'b';
+  }
 };
+
+using PGNParser = BasicPGNParser<MoveFactory>;
@@ -0,0 +1,164 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "byte_source.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Reads the wrapped source on its own thread, keeping up to `blocks` blocks filled ahead of the
+// consumer, so a read stalling on the disk overlaps with lexing of the blocks before it. The
+// blocks form a ring handed over through two counters: `produced_` is only advanced by the
+// reader thread and `consumed_` only by read(), so neither side ever takes a lock and each waits
+// on the other's counter only when the ring is full or empty. The wrapped source is only ever
+// touched by the reader thread, its bad() included.
+class ReadAheadSource : public ByteSource
+{
+public:
+  static constexpr size_t DEFAULT_BLOCKS = 4;
+  static constexpr size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+private:
+  struct Block
+  {
+    std::vector<char> data;
+    size_t size = 0; // 0 marks the end of the input
+  };
+
+  std::unique_ptr<ByteSource> input_;
+  std::vector<Block> blocks_;
+  std::atomic<uint64_t> produced_{0};
+  std::atomic<uint64_t> consumed_{0};
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> bad_{false}; // input_->bad() as of the last read of the reader thread
+  std::exception_ptr error_; // published by the release store of the last block
+  std::thread worker_;
+
+  // consumer side, only touched by read()
+  uint64_t current_ = 0;
+  size_t pos_ = 0;
+  bool holding_ = false;
+
+  void run()
+  {
+    const uint64_t ring = blocks_.size();
+    for (uint64_t i = 0;; ++i)
+    {
+      uint64_t consumed = consumed_.load(std::memory_order_acquire);
+      while (i >= consumed + ring)
+      {
+        consumed_.wait(consumed, std::memory_order_acquire);
+        consumed = consumed_.load(std::memory_order_acquire);
+      }
+      if (stop_.load(std::memory_order_relaxed))
+        return;
+
+      Block& block = blocks_[i % ring];
+      block.size = 0;
+      try
+      {
+        while (block.size < block.data.size())
+        {
+          const size_t n =
+            input_->read(block.data.data() + block.size, block.data.size() - block.size);
+          if (n == 0)
+            break;
+          block.size += n;
+        }
+      }
+      catch (...)
+      {
+        error_ = std::current_exception();
+        block.size = 0;
+      }
+      bad_.store(input_->bad(), std::memory_order_release);
+
+      produced_.store(i + 1, std::memory_order_release);
+      produced_.notify_one();
+      if (block.size == 0)
+        return;
+    }
+  }
+
+public:
+  explicit ReadAheadSource(std::unique_ptr<ByteSource> input, size_t blocks = DEFAULT_BLOCKS,
+                           size_t block_size = DEFAULT_BLOCK_SIZE)
+    : input_(std::move(input)), blocks_(std::max<size_t>(blocks, 1))
+  {
+    for (auto& block : blocks_)
+      block.data.resize(block_size);
+    worker_ = std::thread([this] { run(); });
+  }
+
+  ReadAheadSource(const ReadAheadSource&) = delete;
+  ReadAheadSource& operator=(const ReadAheadSource&) = delete;
+
+  // Stops the reader thread and waits for it. A read of the wrapped source already in flight can
+  // not be interrupted and is waited for as well, so a pipe which never delivers nor closes
+  // keeps the destructor waiting with it.
+  ~ReadAheadSource()
+  {
+    // frees the whole ring, so a waiting reader wakes up and sees the stop flag
+    stop_.store(true, std::memory_order_relaxed);
+    consumed_.store(UINT64_MAX / 2, std::memory_order_release);
+    consumed_.notify_one();
+    worker_.join();
+  }
+
+  size_t read(char* dst, size_t size) override
+  {
+    Block& block = blocks_[current_ % blocks_.size()];
+    if (!holding_)
+    {
+      uint64_t produced = produced_.load(std::memory_order_acquire);
+      while (produced == current_)
+      {
+        produced_.wait(produced, std::memory_order_acquire);
+        produced = produced_.load(std::memory_order_acquire);
+      }
+      if (block.size == 0)
+      {
+        if (error_)
+          std::rethrow_exception(error_);
+        return 0;
+      }
+      holding_ = true;
+      pos_ = 0;
+    }
+
+    const size_t n = std::min(size, block.size - pos_);
+    std::memcpy(dst, block.data.data() + pos_, n);
+    pos_ += n;
+
+    if (pos_ == block.size)
+    {
+      // hand the block back to the reader thread
+      holding_ = false;
+      consumed_.store(++current_, std::memory_order_release);
+      consumed_.notify_one();
+    }
+    return n;
+  }
+
+  bool bad() const override { return bad_.load(std::memory_order_acquire); }
+};
@@ -0,0 +1,443 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "board.h"
+#include "events.h"
+#include "parser.h"
+#include "scanner.h"
+#include <algorithm>
+#include <exception>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+inline const char* result_name(TerminationMarker result)
+{
+  switch (result)
+  {
+  case TerminationMarker::WHITE_WON:
+    return "1-0";
+  case TerminationMarker::BLAKC_WON:
+    return "0-1";
+  case TerminationMarker::EVEN:
+    return "1/2-1/2";
+  default:
+    return "*";
+  }
+}
+
+struct GameRecord
+{
+  uint64_t offset = 0; // of the first token the parser sees, comments before the game excluded
+  uint32_t plies = 0;
+  TerminationMarker result = TerminationMarker::MANUAL;
+};
+
+// comments, escapes and NAGs between games belong to neither of them
+inline bool is_skipped_token(TokenKind kind)
+{
+  return kind == TokenKind::BraceComment || kind == TokenKind::LineComment ||
+         kind == TokenKind::Escape || kind == TokenKind::NumericGlyph;
+}
+
+inline bool is_result_token(const Token& token, std::string_view text)
+{
+  return token.kind == TokenKind::Asterisk ||
+         (token.kind == TokenKind::Symbol && is_result_symbol(text));
+}
+
+// Follows the tokens of a game with no parsing: a game ends with a result outside of any
+// variation, or right before the `[` of a tag which comes after its movetext. build_game_index
+// splits the input with it and replay_games_lenient skips a malformed game up to the next one.
+class GameBoundary
+{
+  bool in_tag_ = false;
+  bool in_movetext_ = false;
+  int depth_ = 0;
+
+public:
+  enum Step
+  {
+    INSIDE, // the token belongs to the game
+    LAST, // the token is the result of the game
+    NEXT // the token opens the next game already
+  };
+
+  void start()
+  {
+    in_tag_ = in_movetext_ = false;
+    depth_ = 0;
+  }
+
+  // whether the token just stepped over is inside of a tag, `]` excluded
+  bool in_tag() const { return in_tag_; }
+
+  Step step(const Token& token, std::string_view text)
+  {
+    switch (token.kind)
+    {
+    case TokenKind::LeftBrace:
+      if (in_movetext_)
+        return NEXT;
+      in_tag_ = true;
+      return INSIDE;
+    case TokenKind::RightBrace:
+      in_tag_ = false;
+      return INSIDE;
+    case TokenKind::LeftParenthesis:
+      ++depth_;
+      break;
+    case TokenKind::RightParenthesis:
+      depth_ = std::max(depth_ - 1, 0);
+      break;
+    default:
+      break;
+    }
+    if (in_tag_ || is_skipped_token(token.kind))
+      return INSIDE;
+    in_movetext_ = true;
+    return depth_ == 0 && is_result_token(token, text) ? LAST : INSIDE;
+  }
+};
+
+// A game replay_games_lenient gave up on. The reason is only valid during the callback.
+struct RejectedGame
+{
+  uint64_t offset = 0; // of the first token of the game, as GameRecord::offset
+  uint64_t error_offset = 0; // of the token the game was given up at
+  std::string_view reason;
+};
+
+namespace detail
+{
+template <bool Lenient, class OnGame, class OnReject, class Events>
+bool replay_games(TokenScanner& scanner, uint64_t base_offset, OnGame&& on_game,
+                  OnReject&& on_reject, Events& events, CachingMoveFactory* decode)
+{
+  if constexpr (WantsComments<Events>)
+    scanner.keep_comments();
+  if constexpr (Lenient)
+    scanner.set_lenient();
+
+  std::optional<CachingMoveFactory> own_decode;
+  if (!decode)
+    decode = &own_decode.emplace();
+  ChessBoard board;
+  // the moves of the game stay packed from the cache through the parser to the board
+  BasicPGNParser<CachingMoveFactory&> parser(*decode);
+  parser.set_lenient(Lenient);
+  std::vector<PackedSan> moves;
+  GameRecord record;
+  bool in_game = false;
+  // only used by the lenient replay
+  GameBoundary boundary;
+  GameBoundary::Step step = GameBoundary::INSIDE;
+  bool skipping = false;
+  std::string reason;
+  // a malformed game is given up on with no exception and skipped up to the next one, so the
+  // tokens of the good games pay for a switch and a couple of flags only
+  auto reject = [&](const Token& token, std::string_view why)
+  {
+    on_reject(RejectedGame{record.offset, base_offset + token.offset, why});
+    board.reset();
+    parser.reset();
+    moves.clear();
+    // unless the bad token is the result itself
+    skipping = in_game = step != GameBoundary::LAST;
+  };
+
+  for (const auto& token : scanner)
+  {
+    const std::string_view text = scanner.text(token);
+    if constexpr (Lenient)
+    {
+      if (skipping)
+      {
+        step = boundary.step(token, text);
+        if (step == GameBoundary::INSIDE)
+          continue;
+        skipping = in_game = false;
+        if (step == GameBoundary::LAST)
+          continue;
+      }
+    }
+
+    if (!in_game)
+    {
+      if (is_skipped_token(token.kind))
+        continue;
+      in_game = true;
+      record = {base_offset + token.offset, 0, TerminationMarker::MANUAL};
+      if constexpr (Lenient)
+        boundary.start();
+    }
+
+    if constexpr (Lenient)
+    {
+      step = boundary.step(token, text);
+      if (step == GameBoundary::NEXT)
+      {
+        // the tags of the next game follow moves with no result, which is read as the next game
+        reject(token, "the game has no result");
+        skipping = false;
+        record = {base_offset + token.offset, 0, TerminationMarker::MANUAL};
+        boundary.start();
+        step = boundary.step(token, text);
+      }
+    }
+
+    auto action = parser.consume_token(token, text, events);
+    if constexpr (Lenient)
+    {
+      if (parser.failed())
+      {
+        reject(token, parser.error());
+        continue;
+      }
+    }
+    if (!action)
+      continue;
+
+    if (action->index() == index_of<Finish>)
+    {
+      record.result = action->result();
+      if constexpr (std::is_invocable_v<OnGame&, const GameRecord&, const ChessBoard&,
+                                        std::span<const PackedSan>>)
+        on_game(static_cast<const GameRecord&>(record), static_cast<const ChessBoard&>(board),
+                std::span<const PackedSan>(moves));
+      else
+        on_game(static_cast<const GameRecord&>(record), static_cast<const ChessBoard&>(board));
+      board.reset();
+      parser.reset();
+      moves.clear();
+      in_game = false;
+      continue;
+    }
+    if (action->index() == index_of<Ignore>)
+      continue;
+
+    moves.push_back(*action);
+    ++record.plies;
+    if constexpr (Lenient)
+    {
+      if (!board.try_apply(moves.back()))
+      {
+        reason.assign("the move cannot be played at [").append(text).append("]");
+        reject(token, reason);
+      }
+    }
+    else
+      board.apply(moves.back());
+  }
+
+  if (scanner.is_bad())
+    throw std::runtime_error("failed to read the input");
+  return in_game && !skipping;
+}
+} // namespace detail
+
+// Replays every game of the scanner, calling on_game(const GameRecord&, const ChessBoard&) with
+// the final position once its result is read, or on_game(const GameRecord&, const ChessBoard&,
+// std::span<const PackedSan>) to get the moves of its main line as well: the parser hands them
+// out packed into a flat array of the game, which the board plays from. The array is reused for
+// the next game. `base_offset` is added to the token offsets, so records of a chunk carry offsets
+// into the whole file. `events` gets the callbacks described at BasicPGNParser along the way, the
+// ones of a game all before its on_game. The SANs are looked up in `decode` when given, so its
+// hit rate could be reported, in a cache of the replay otherwise. Returns whether the input ended
+// in the middle of a game.
+template <class OnGame, class Events>
+bool replay_games(TokenScanner& scanner, uint64_t base_offset, OnGame&& on_game, Events& events,
+                  CachingMoveFactory* decode = nullptr)
+{
+  return detail::replay_games<false>(scanner, base_offset, std::forward<OnGame>(on_game),
+                                     [](const RejectedGame&) {}, events, decode);
+}
+
+template <class OnGame>
+bool replay_games(TokenScanner& scanner, uint64_t base_offset, OnGame&& on_game)
+{
+  NoEvents none;
+  return replay_games(scanner, base_offset, std::forward<OnGame>(on_game), none);
+}
+
+// The same as replay_games, except that a malformed game is not the end of the replay: bytes
+// which do not lex, tokens out of place, symbols which are no moves and moves which can not be
+// played make it reported to on_reject(const RejectedGame&) in place of on_game, and the replay
+// goes on from the next game. Nothing is thrown for those, so a dirty input costs no unwinding.
+// `events` may have got a part of the callbacks of a rejected game already.
+template <class OnGame, class OnReject, class Events>
+bool replay_games_lenient(TokenScanner& scanner, uint64_t base_offset, OnGame&& on_game,
+                          OnReject&& on_reject, Events& events,
+                          CachingMoveFactory* decode = nullptr)
+{
+  return detail::replay_games<true>(scanner, base_offset, std::forward<OnGame>(on_game),
+                                    std::forward<OnReject>(on_reject), events, decode);
+}
+
+template <class OnGame, class OnReject>
+bool replay_games_lenient(TokenScanner& scanner, uint64_t base_offset, OnGame&& on_game,
+                          OnReject&& on_reject)
+{
+  NoEvents none;
+  return replay_games_lenient(scanner, base_offset, std::forward<OnGame>(on_game),
+                              std::forward<OnReject>(on_reject), none);
+}
+
+// Parses every game of the scanner into a flat array of packed moves with no board, calling
+// on_game(const GameRecord&, std::span<const PackedSan>) with the moves of the main line once its
+// result is read; the array is reused for the next game. The moves are looked up in `decode`
+// and never go through Moves. Returns whether the input ended in the middle of a game.
+template <class OnGame>
+bool read_packed_games(TokenScanner& scanner, uint64_t base_offset, CachingMoveFactory& decode,
+                       OnGame&& on_game)
+{
+  struct Events
+  {
+    CachingMoveFactory& decode;
+    std::vector<PackedSan> moves;
+
+    void on_move(std::string_view san, bool white, unsigned depth)
+    {
+      if (depth != 0)
+        return;
+      const PackedSan move = decode(san, white);
+      if (move.index() != index_of<Ignore>)
+        moves.push_back(move);
+    }
+  } events{decode, {}};
+
+  BasicPGNParser<ResultOnlyMoves> parser;
+  GameRecord record;
+  bool in_game = false;
+  for (const auto& token : scanner)
+  {
+    if (!in_game)
+    {
+      if (is_skipped_token(token.kind))
+        continue;
+      in_game = true;
+      record = {base_offset + token.offset, 0, TerminationMarker::MANUAL};
+      events.moves.clear();
+    }
+
+    auto action = parser.consume_token(token, scanner.text(token), events);
+    if (const Finish* finish = action ? std::get_if<Finish>(&*action) : nullptr)
+    {
+      record.plies = static_cast<uint32_t>(events.moves.size());
+      record.result = finish->marker;
+      on_game(static_cast<const GameRecord&>(record), std::span<const PackedSan>(events.moves));
+      parser.reset();
+      in_game = false;
+    }
+  }
+
+  if (scanner.is_bad())
+    throw std::runtime_error("failed to read the input");
+  return in_game;
+}
+
+template <class OnGame>
+bool read_packed_games(TokenScanner& scanner, uint64_t base_offset, OnGame&& on_game)
+{
+  CachingMoveFactory decode;
+  return read_packed_games(scanner, base_offset, decode, std::forward<OnGame>(on_game));
+}
+
+// Plays packed moves on the board and adds the squares each was resolved to to `played`, so a
+// game is kept in 6 bytes a move. Returns false at the first move which can not be played.
+inline bool replay_packed(std::span<const PackedSan> moves, ChessBoard& board,
+                          std::vector<PackedMove>& played)
+{
+  for (PackedSan move : moves)
+  {
+    if (!board.try_apply(move, &played.emplace_back()))
+    {
+      played.pop_back();
+      return false;
+    }
+  }
+  return true;
+}
+
+// Replays the ranges [bounds[i], bounds[i + 1]) each on its own thread with its own scanner,
+// parser and board; every range has to start at a game. summarize(const GameRecord&,
+// const ChessBoard&) is called for every game and its results are returned in file order, the
+// same as replaying the whole input sequentially would give. Offsets are relative to `begin`.
+// `unfinished` is set, when given, to whether the input ended in the middle of a game, which is
+// what replay_games returns. Every thread looks the SANs up in a cache of its own, `decode` gets
+// the lookups and hits of all of them when given.
+template <class Summarize>
+auto replay_games_parallel(const char* begin, const std::vector<const char*>& bounds,
+                           Summarize&& summarize, bool* unfinished = nullptr,
+                           CachingMoveFactory* decode = nullptr)
+{
+  using Summary = std::invoke_result_t<Summarize&, const GameRecord&, const ChessBoard&>;
+
+  const size_t chunks = bounds.size() - 1;
+  std::vector<std::vector<Summary>> results(chunks);
+  std::vector<std::exception_ptr> errors(chunks);
+  std::vector<CachingMoveFactory> caches(chunks);
+  auto replay_chunk = [&](size_t i)
+  {
+    try
+    {
+      TokenScanner scanner(bounds[i], bounds[i + 1]);
+      NoEvents none;
+      const bool cut = replay_games(
+        scanner, bounds[i] - begin, [&](const GameRecord& record, const ChessBoard& board)
+        { results[i].push_back(summarize(record, board)); }, none, &caches[i]);
+      if (cut && i + 1 < chunks)
+        throw std::runtime_error("game before offset " + std::to_string(bounds[i + 1] - begin) +
+                                 " has no result");
+      if (i + 1 == chunks && unfinished)
+        *unfinished = cut;
+    }
+    catch (...)
+    {
+      errors[i] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < chunks; ++i)
+    workers.emplace_back(replay_chunk, i);
+  if (chunks > 0)
+    replay_chunk(0);
+  for (auto& worker : workers)
+    worker.join();
+
+  if (chunks == 0 && unfinished)
+    *unfinished = false;
+  std::vector<Summary> games;
+  for (size_t i = 0; i < chunks; ++i)
+  {
+    if (errors[i])
+      std::rethrow_exception(errors[i]);
+    if (decode)
+      decode->add_counts(caches[i]);
+    games.insert(games.end(), std::make_move_iterator(results[i].begin()),
+                 std::make_move_iterator(results[i].end()));
+  }
+  return games;
+}
@@ -16,32 +16,266 @@
 
 #pragma once
 
+#include "byte_source.h"
 #include "common.h"
+#include "lexer.h"
+#include "simd_scan.h"
 #include "tokens.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <span>
 #include <stdexcept>
-#include <variant>
+#include <string>
+#include <string_view>
+#include <vector>
 
 class TokenScanner
 {
 public:
+  // big enough to amortize a read call, small enough to stay in L2
+  static constexpr size_t BLOCK_SIZE = 256 * 1024;
+  // the buffer only grows for a single token longer than a block, which no sane input has;
+  // past this limit the input is rejected so memory stays bounded whatever is streamed in
+  static constexpr size_t MAX_BUFFER_SIZE = 64 * 1024 * 1024;
+
 private:
-  std::istream& file_;
+  // non-seekable inputs (pipes, stdin, istreams) are read block by block into buffer_ which
+  // slides over the input, otherwise the scanner walks [cur_, end_) of the caller's memory
+  std::unique_ptr<ByteSource> owned_source_;
+  ByteSource* source_ = nullptr;
+  std::vector<char> buffer_;
+
+  // the part of the input which is currently addressable, starting at absolute window_offset_
+  const char* window_ = nullptr;
+  uint64_t window_offset_ = 0;
+  const char* cur_ = nullptr;
+  const char* end_ = nullptr;
+
   Token current_token_;
-  char c_;
+  bool keep_comments_ = false;
+  bool lenient_ = false;
+
+  enum class ScanResult
+  {
+    SCANNED,
+    END_OF_INPUT,
+    END_OF_WINDOW // the token continues past the window, but the caller did not allow a refill
+  };
+
+  // reads the next block behind the bytes from `keep` onwards, which are the part of the token
+  // scanned so far and must stay contiguous; `keep` is moved along with them
+  bool refill(const char*& keep)
+  {
+    if (!source_)
+      return false;
+
+    const size_t kept = end_ - keep;
+    window_offset_ += keep - window_;
+    if (kept > 0)
+      std::memmove(buffer_.data(), keep, kept);
+
+    // a single token does not fit into a block, so let the buffer grow
+    if (buffer_.size() - kept < BLOCK_SIZE / 2)
+    {
+      if (buffer_.size() * 2 > MAX_BUFFER_SIZE)
+      {
+        throw std::runtime_error(std::string("token at offset [")
+                                   .append(std::to_string(window_offset_))
+                                   .append("] is too long"));
+      }
+      buffer_.resize(buffer_.size() * 2);
+    }
+
+    const size_t read = source_->read(buffer_.data() + kept, buffer_.size() - kept);
+
+    window_ = keep = buffer_.data();
+    cur_ = keep + kept;
+    end_ = cur_ + read;
+    return read > 0;
+  }
+
+  uint64_t offset_of(const char* p) const { return window_offset_ + (p - window_); }
+
+  ScanResult scan_token(Token& token, bool may_refill)
+  {
+    // skip separators
+    for (;;)
+    {
+      cur_ = skip_separators(cur_, end_);
+      if (cur_ != end_)
+        break;
+
+      if (!may_refill)
+        return ScanResult::END_OF_WINDOW;
+
+      const char* keep = end_;
+      if (!refill(keep))
+        return ScanResult::END_OF_INPUT;
+    }
+
+    const char* token_begin = cur_;
+    const uint64_t token_offset = offset_of(token_begin);
+    LexState state = LEX_START;
+    for (;;)
+    {
+      const char* p = cur_;
+      const char* end = end_;
+      if (is_skip_state(state))
+        p = find_char(p, end, skip_terminator(state));
+
+      while (p != end)
+      {
+        // the hot path: stay inside the current token
+        const LexTransition* t = &lex_step(state, *p);
+        while (t->action == LEX_CONTINUE)
+        {
+          state = t->next;
+          if (++p == end)
+            break;
+          t = &lex_step(state, *p);
+        }
+        if (p == end)
+          break;
+
+        switch (t->action)
+        {
+        case LEX_SKIP:
+          ++p;
+          state = t->next;
+          p = find_char(p, end, skip_terminator(state));
+          continue;
+        case LEX_EMIT:
+          ++p;
+          [[fallthrough]];
+        case LEX_EMIT_BEFORE:
+          cur_ = p;
+          make_token(token, t->kind, token_begin, token_offset, p);
+          return ScanResult::SCANNED;
+        case LEX_FAIL_START:
+          if (lenient_)
+            return scan_invalid(token, token_begin, token_offset, p);
+          throw std::runtime_error(std::string("bad format. expecing digit / character, but got [")
+                                     .append(std::string(1, *p))
+                                     .append("]"));
+        case LEX_FAIL_STRING:
+        default:
+          if (lenient_)
+            return scan_invalid(token, token_begin, token_offset, p);
+          throw std::runtime_error(
+            std::string("got unexpected char [").append(std::string(1, *p)).append("]"));
+        }
+      }
+
+      if (!may_refill)
+      {
+        // nothing was refilled during this call, so the token can simply be scanned again
+        cur_ = token_begin;
+        return ScanResult::END_OF_WINDOW;
+      }
+
+      // comments carry no value, so their bytes do not need to survive the refill unless asked
+      cur_ = p;
+      if (is_skip_state(state) && !keep_comments_)
+        token_begin = cur_;
+
+      if (!refill(token_begin))
+      {
+        // symbols and line comments may as well be terminated by the end of the input,
+        // everything else is cut off
+        const TokenKind kind = lex_eof_kind(state);
+        if (kind == TokenKind::None)
+          return ScanResult::END_OF_INPUT;
+
+        make_token(token, kind, token_begin, token_offset, end_);
+        cur_ = end_;
+        return ScanResult::SCANNED;
+      }
+    }
+  }
+
+  // the bytes of the token so far and the offending one at `bad` are handed to the parser to
+  // reject, the scan goes on right after them
+  ScanResult scan_invalid(Token& token, const char* begin, uint64_t offset, const char* bad)
+  {
+    cur_ = bad + 1;
+    make_token(token, TokenKind::Invalid, begin, offset, cur_);
+    return ScanResult::SCANNED;
+  }
+
+  // `begin` is only meaningful for tokens with a value, comments may have lost their first bytes
+  // to a refill already unless keep_comments() is on
+  void make_token(Token& token, TokenKind kind, const char* begin, uint64_t offset,
+                  const char* end) const
+  {
+    token.kind = kind;
+    token.offset = offset;
+    token.length = static_cast<uint32_t>(offset_of(end) - offset);
+    token.flags = 0;
+    token.number = 0;
+
+    if (kind == TokenKind::String)
+    {
+      // only the content between quotes is of any interest
+      ++token.offset;
+      token.length -= 2;
+      if (std::memchr(begin + 1, '\\', token.length))
+        token.flags |= Token::ESCAPED;
+    }
+    else if (kind == TokenKind::Integer || kind == TokenKind::NumericGlyph)
+    {
+      // a NAG starts with `$`
+      uint32_t number = 0;
+      const char* digits = begin + (kind == TokenKind::NumericGlyph);
+      for (const char* p = digits; p != end && number <= UINT16_MAX; ++p)
+        number = number * 10 + (*p - '0');
+      token.number = static_cast<uint16_t>(std::min<uint32_t>(number, UINT16_MAX));
+    }
+  }
 
 public:
-  TokenScanner(std::istream& file) : file_(file) {}
+  TokenScanner(ByteSource& source) : source_(&source), buffer_(BLOCK_SIZE) {}
+  TokenScanner(std::istream& file)
+    : owned_source_(std::make_unique<IstreamSource>(file)), source_(owned_source_.get()),
+      buffer_(BLOCK_SIZE)
+  {
+  }
+  TokenScanner(const char* begin, const char* end) : window_(begin), cur_(begin), end_(end) {}
+  TokenScanner(std::string_view input) : TokenScanner(input.data(), input.data() + input.size())
+  {
+  }
+
+  // text of a token from the current window; for the istream mode it stays valid only until the
+  // next token is scanned, or until the next batch
+  std::string_view text(const Token& token) const
+  {
+    return {window_ + (token.offset - window_offset_), token.length};
+  }
+
+  // fills the batch with as many tokens as the current window holds, so all of them could be
+  // resolved with text() at the same time; returns 0 at the end of the input
+  size_t next_batch(std::span<Token> batch)
+  {
+    size_t count = 0;
+    while (count < batch.size())
+    {
+      ScanResult r = scan_token(batch[count], count == 0);
+      if (r != ScanResult::SCANNED)
+        break;
+      ++count;
+    }
+    return count;
+  }
 
   struct Iterator
   {
     using iterator_category = std::input_iterator_tag;
     using value_type = Token;
-    using pointer = Token*;
-    using reference = Token&;
+    using pointer = const Token*;
+    using reference = const Token&;
 
     TokenScanner* scanner_;
-    bool repeat_ = false;
 
     Iterator() : scanner_(nullptr) {}
     Iterator(TokenScanner* scanner) : scanner_(scanner) { scan_token(); }
@@ -51,8 +285,8 @@ public:
       return *this;
     }
 
-    Token& operator*() { return scanner_->current_token_; }
-    Token* operator->() { return &scanner_->current_token_; }
+    const Token& operator*() const { return scanner_->current_token_; }
+    const Token* operator->() const { return &scanner_->current_token_; }
 
     friend bool operator==(const Iterator& l, const Iterator& r)
     {
@@ -60,134 +294,11 @@ public:
     }
     friend bool operator!=(const Iterator& l, const Iterator& r) { return !operator==(l, r); }
 
-    bool is_token_separator(char c) { return c == ' ' || c == '\n' || c == '\t'; }
-
   private:
     void scan_token()
     {
-      bool expecting_new_token = true;
-      bool token_terminated = false;
-      scanner_->current_token_.emplace<0>();
-      while (!token_terminated && !scanner_->file_.eof() && (repeat_ || scanner_->file_.get(scanner_->c_)))
-      {
-        if (expecting_new_token && is_token_separator(scanner_->c_))
-        {
-          repeat_ = false;
-          continue;
-        }
-
-        if (expecting_new_token)
-        {
-          switch (scanner_->c_)
-          {
-          case '[':
-            scanner_->current_token_ = LeftBraceToken();
-            break;
-          case ']':
-            scanner_->current_token_ = RightBraceToken();
-            break;
-          case '(':
-            scanner_->current_token_ = LeftParenthesisToken();
-            break;
-          case ')':
-            scanner_->current_token_ = RightParenthesisToken();
-            break;
-          case '\"':
-            scanner_->current_token_ = StringToken();
-            break;
-          case '.':
-            scanner_->current_token_ = PeriodToken();
-            break;
-          case '*':
-            scanner_->current_token_ = AsterkixToken();
-            break;
-          case '{':
-            scanner_->current_token_ = BraceComment();
-            break;
-          case '$':
-            scanner_->current_token_ = NumericGlyphToken();
-            break;
-          case ';':
-            scanner_->current_token_ = LineComment();
-            break;
-          case '%':
-            scanner_->current_token_ = EscapeToken();
-            break;
-          default:
-            if (std::isdigit(scanner_->c_) || std::isalpha(scanner_->c_))
-            {
-              scanner_->current_token_ = SymbolToken();
-            }
-            else
-            {
-              throw std::runtime_error(
-                std::string("bad format. expecing digit / character, but got [")
-                  .append(std::string(1, scanner_->c_))
-                  .append("]"));
-            }
-          }
-
-          expecting_new_token = false;
-        }
-
-        {
-          token_terminated = std::visit(
-            overloaded{
-              [](std::monostate& t) { return true; },
-              [&](auto& t)
-              {
-                AcceptResult r = t.accept(scanner_->c_);
-                switch (r)
-                {
-                case AcceptResult::INVALID:
-                {
-                  throw std::runtime_error(
-                    std::string("got unexpected char [").append(std::string(1, scanner_->c_)).append("]"));
-                }
-                case AcceptResult::TERMINATED_CONSUMED:
-                {
-                  repeat_ = false;
-                  return true;
-                }
-                case AcceptResult::TERMINATED_NONCONSUMED:
-                {
-                  // need to start parsing new token, but the current symbol has to be re-tried!
-                  using token_type = std::decay_t<decltype(t)>;
-                  if constexpr (std::is_same_v<token_type, SymbolToken>)
-                  {
-                    if (t.number_only_)
-                    {
-                      // shall be inserted as IntegerToken!
-                      Token integer_token =
-                        IntegerToken{std::get<SymbolToken>(scanner_->current_token_).value_};
-                      scanner_->current_token_ = integer_token;
-                    }
-                  }
-
-                  repeat_ = true;
-                  return true;
-                }
-                case AcceptResult::CONSUMED:
-                {
-                  repeat_ = false;
-                  return false;
-                }
-                default:
-                {
-                  throw std::runtime_error(
-                    std::string("got unexpected return value from accept function [")
-                      .append(std::to_string(static_cast<size_t>(r)))
-                      .append("]"));
-                  break;
-                }
-                }
-              }},
-            scanner_->current_token_);
-        }
-      }
-
       // finish reading the file!
-      if (!token_terminated)
+      if (scanner_->scan_token(scanner_->current_token_, true) != ScanResult::SCANNED)
         scanner_ = nullptr;
     }
   };
@@ -196,5 +307,16 @@ public:
   Iterator begin() { return Iterator(this); }
   Iterator end() { return {}; }
 
-  bool is_bad() const { return file_.bad(); }
+  bool is_bad() const { return source_ && source_->bad(); }
+
+  // makes text() of comments and escape lines valid in the streamed mode as well, at the price of
+  // keeping their bytes across refills; a memory input always has them
+  void keep_comments(bool keep = true) { keep_comments_ = keep; }
+
+  // bytes no token could start with or contain become Invalid tokens instead of an exception,
+  // so a bad game could be rejected by the parser and the next one read on
+  void set_lenient(bool lenient = true) { lenient_ = lenient; }
+
+  // how far into the input the scanner got, in bytes
+  uint64_t bytes_scanned() const { return offset_of(cur_); }
 };
@@ -0,0 +1,156 @@
+/*
+ * Copyright(c) 2024-present Mykola Garkusha.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define CHESS_REPLAY_X86 1
+#else
+  #define CHESS_REPLAY_X86 0
+#endif
+
+// Kernels for the long runs of bytes the scanner does not care about: whitespace between tokens
+// and the bodies of comments. Each kernel returns the first position in [p, end) which is NOT
+// skipped, or end. The vector versions are compiled with target attributes and picked at runtime,
+// so the binary itself does not require avx2.
+
+inline bool is_separator_byte(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r'; }
+
+inline const char* skip_separators_scalar(const char* p, const char* end)
+{
+  while (p != end && is_separator_byte(*p))
+    ++p;
+  return p;
+}
+
+inline const char* find_char_scalar(const char* p, const char* end, char c)
+{
+  while (p != end && *p != c)
+    ++p;
+  return p;
+}
+
+#if CHESS_REPLAY_X86
+
+__attribute__((target("sse4.2"))) inline const char* skip_separators_sse42(const char* p,
+                                                                          const char* end)
+{
+  const __m128i separators = _mm_setr_epi8(' ', '\n', '\t', '\r', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  for (; end - p >= 16; p += 16)
+  {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const int idx = _mm_cmpestri(separators, 4, v, 16,
+                                 _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY |
+                                   _SIDD_LEAST_SIGNIFICANT);
+    if (idx < 16)
+      return p + idx;
+  }
+  return skip_separators_scalar(p, end);
+}
+
+__attribute__((target("sse4.2"))) inline const char* find_char_sse42(const char* p,
+                                                                    const char* end, char c)
+{
+  const __m128i needle = _mm_set1_epi8(c);
+  for (; end - p >= 16; p += 16)
+  {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return find_char_scalar(p, end, c);
+}
+
+__attribute__((target("avx2"))) inline const char* skip_separators_avx2(const char* p,
+                                                                       const char* end)
+{
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i new_line = _mm256_set1_epi8('\n');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i carriage_return = _mm256_set1_epi8('\r');
+  for (; end - p >= 32; p += 32)
+  {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i is_separator =
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, new_line)),
+                      _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, carriage_return)));
+    const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(is_separator));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return skip_separators_sse42(p, end);
+}
+
+__attribute__((target("avx2"))) inline const char* find_char_avx2(const char* p, const char* end,
+                                                                  char c)
+{
+  const __m256i needle = _mm256_set1_epi8(c);
+  for (; end - p >= 32; p += 32)
+  {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return find_char_sse42(p, end, c);
+}
+
+#endif
+
+struct ScanKernels
+{
+  const char* name;
+  const char* (*skip_separators)(const char* p, const char* end);
+  const char* (*find_char)(const char* p, const char* end, char c);
+};
+
+inline ScanKernels select_scan_kernels()
+{
+#if CHESS_REPLAY_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return {"avx2", skip_separators_avx2, find_char_avx2};
+  if (__builtin_cpu_supports("sse4.2"))
+    return {"sse4.2", skip_separators_sse42, find_char_sse42};
+#endif
+  return {"scalar", skip_separators_scalar, find_char_scalar};
+}
+
+inline const ScanKernels& scan_kernels()
+{
+  static const ScanKernels kernels = select_scan_kernels();
+  return kernels;
+}
+
+inline const char* skip_separators(const char* p, const char* end)
+{
+  // most runs are a single space, which is not worth an indirect call
+  if (p == end || !is_separator_byte(*p))
+    return p;
+  ++p;
+  if (p == end || !is_separator_byte(*p))
+    return p;
+  return scan_kernels().skip_separators(p, end);
+}
+
+inline const char* find_char(const char* p, const char* end, char c)
+{
+  return scan_kernels().find_char(p, end, c);
+}
@@ -15,12 +15,22 @@
  */
 
 #include "board.h"
+#include "commands.h"
 #include "common.h"
+#include "decompress.h"
+#include "events.h"
+#include "game_index.h"
+#include "games.h"
+#include "headers.h"
+#include "move_tree.h"
 #include "moves.h"
 #include "parser.h"
+#include "read_ahead.h"
+#include "replay.h"
 #include "scanner.h"
 #include <assert.h>
 #include <exception>
+#include <fstream>
 #include <sstream>
 
 void test_move_parser()
@@ -70,15 +80,15 @@ void test_move_parser()
 
     {
       N = 4;
+      // both squares given, so read as a long move the board plays from its source square
       Moves m = MoveFactory()(std::string{"a7xb8=Q"}, false);
-      assert(m.index() == 2);
-      const NextMove& n = std::get<NextMove>(m);
+      assert(m.index() == 5);
+      const LongMove& n = std::get<LongMove>(m);
       assert(n.is_white_move == false);
-      assert(n.dst.x == 0);
-      assert(n.dst.y == 1);
-      assert(n.piece == 'P');
-      assert(n.src.y == 0);
-      assert(n.src.x == 1);
+      assert(n.to == 0 * 8 + 1);
+      assert(n.from == 1 * 8 + 0);
+      assert(n.capture);
+      assert(n.promote_piece == 'Q');
     }
 
     {
@@ -100,6 +110,34 @@ void test_move_parser()
   }
 }
 
+void test_special_symbols()
+{
+  const MoveFactory decode;
+  assert(std::holds_alternative<KingCastling>(decode("O-O", true)));
+  assert(std::get<QueenCastling>(decode("O-O-O", false)).is_white_move == false);
+  assert(std::get<Finish>(decode("1-0", true)).marker == TerminationMarker::WHITE_WON);
+  assert(std::get<Finish>(decode("0-1", true)).marker == TerminationMarker::BLAKC_WON);
+  assert(std::get<Finish>(decode("1/2-1/2", false)).marker == TerminationMarker::EVEN);
+  assert(std::holds_alternative<Ignore>(decode("e", true)));
+  assert(std::holds_alternative<Ignore>(decode("p", true)));
+  // moves sharing a length or a first byte with them
+  assert(std::get<NextMove>(decode("e4", true)).piece == 'P');
+  assert(std::get<NextMove>(decode("Nf3", true)).piece == 'N');
+  assert(std::get<NextMove>(decode("exd5+", true)).capture);
+
+  // the token is only copied on request, the move prints the same either way
+  const NextMove plain = std::get<NextMove>(decode("Nbxd7+", false));
+  assert(plain.orig_token.empty());
+  const NextMove kept = std::get<NextMove>(TokenKeepingMoveFactory()("Nbxd7+", false));
+  assert(kept.orig_token == "Nbxd7+");
+  std::ostringstream printed;
+  printed << Moves(plain) << " " << Moves(kept) << " " << Moves(decode("a8=Q", true));
+  assert(printed.str() == "Nbxd7 Nbxd7+ Pa8=Q");
+
+  std::string error;
+  assert(std::holds_alternative<Ignore>(decode("Zf3", true, &error)) && error.ends_with("Zf3"));
+}
+
 void test_king_move()
 {
   ChessBoard b;
@@ -686,6 +724,26 @@ void test_pawn_en_passant_board_moves()
     b.manualy_set_cell(another_black_pawn, {!white_move, 'P'});
     b.apply(MoveFactory()(std::string{"a3"}, !white_move));
   }
+
+  // en passant is refused once a move has been played after the double move
+  {
+    ChessBoard b;
+    b.clear();
+    bool white_move = true;
+    Coordinates orig_black_pawn{1, 1};
+    Coordinates orig_white_pawn{3, 2};
+    b.manualy_set_cell(orig_black_pawn, {!white_move, 'P'});
+    b.manualy_set_cell(orig_white_pawn, {white_move, 'P'});
+    b.manualy_set_cell({7, 7}, {white_move, 'K'});
+    b.manualy_set_cell({0, 7}, {!white_move, 'K'});
+    b.apply(MoveFactory()(std::string{"b5"}, !white_move));
+    assert(b.get({3, 1}).double_move);
+    b.apply(MoveFactory()(std::string{"Kg1"}, white_move));
+    b.apply(MoveFactory()(std::string{"Kg8"}, !white_move));
+    assert(!b.get({3, 1}).double_move);
+
+    assert(!b.try_apply(MoveFactory()(std::string{"cxb6"}, white_move)));
+  }
 }
 
 void test_knight_board_moves()
@@ -823,7 +881,7 @@ bool verify(const std::string& pgn, const std::string& expected, int N)
     PGNParser parser;
     for (const auto& token : scanner)
     {
-      auto action = parser.consume_token(token);
+      auto action = parser.consume_token(token, scanner.text(token));
       if (action)
       {
         if (std::get_if<Finish>(&*action))
@@ -862,6 +920,1008 @@ wR|wN|wB|wQ|wK|wB|wN|wR
   assert(verify("(asdfasdf {asdfasd)(f})", expected, 1));
 }
 
+std::string token_value(const TokenScanner& scanner, const Token& token)
+{
+  std::string scratch;
+  std::string v = token_kind_name(token.kind);
+  if (token.kind == TokenKind::String || token.kind == TokenKind::Symbol ||
+      token.kind == TokenKind::Integer)
+    v.append(":").append(unescape(token, scanner.text(token), scratch));
+  return v;
+}
+
+std::vector<std::string> scan_values(TokenScanner& scanner)
+{
+  std::vector<std::string> values;
+  for (const auto& token : scanner)
+    values.push_back(token_value(scanner, token));
+  return values;
+}
+
+// hands the input out in tiny pieces, like a slow pipe would
+class TrickleSource : public ByteSource
+{
+  std::string_view input_;
+  size_t piece_;
+
+public:
+  TrickleSource(std::string_view input, size_t piece) : input_(input), piece_(piece) {}
+
+  size_t read(char* dst, size_t size) override
+  {
+    const size_t n = std::min({size, piece_, input_.size()});
+    std::memcpy(dst, input_.data(), n);
+    input_.remove_prefix(n);
+    return n;
+  }
+};
+
+void test_scanner_range_input()
+{
+  const std::string pgn = R"([Event "F/S \"Return\" Match"]
+[Site "C:\\games"]
+1. e4 {comment} e5 2. Nf3 $1 Nc6 ; line comment
+3. Bb5 *
+)";
+
+  std::istringstream s(pgn);
+  TokenScanner stream_scanner(s);
+  TokenScanner range_scanner(std::string_view{pgn});
+  const auto stream_values = scan_values(stream_scanner);
+  const auto range_values = scan_values(range_scanner);
+  assert(stream_values == range_values);
+  assert(range_values[2] == R"(StringToken:F/S "Return" Match)");
+  assert(range_values[6] == R"(StringToken:C:\games)");
+  assert(range_values[8] == "IntegerToken:1");
+  assert(range_values[10] == "SymbolToken:e4");
+  assert(range_values.back() == "AsterixToken");
+
+  // tokens crossing block boundaries, including ones bigger than a whole block
+  std::string big = "[Annotator \"" + std::string(TokenScanner::BLOCK_SIZE + 7, 'a') + "\"]\n";
+  for (size_t i = 0; big.size() < 3 * TokenScanner::BLOCK_SIZE; ++i)
+    big.append(std::to_string(i)).append(". Nf3 {").append(i % 1000, 'c').append("} Nf6 ");
+  big.append("*");
+
+  std::istringstream big_stream(big);
+  TokenScanner big_stream_scanner(big_stream);
+  TokenScanner big_range_scanner(std::string_view{big});
+  const auto big_values = scan_values(big_range_scanner);
+  assert(scan_values(big_stream_scanner) == big_values);
+
+  for (size_t piece : {1, 7, 4096})
+  {
+    TrickleSource source(big, piece);
+    TokenScanner trickle_scanner(source);
+    assert(scan_values(trickle_scanner) == big_values);
+  }
+
+  // batches are resolved only after the whole batch is scanned
+  std::istringstream batch_stream(big);
+  TokenScanner batch_scanner(batch_stream);
+  std::vector<Token> batch(1000);
+  std::vector<std::string> batch_values;
+  while (size_t n = batch_scanner.next_batch(batch))
+  {
+    for (size_t i = 0; i < n; ++i)
+      batch_values.push_back(token_value(batch_scanner, batch[i]));
+  }
+  assert(batch_values == big_values);
+}
+
+void test_compact_tokens()
+{
+  const std::string pgn = "12. Nf3 { abc } \"a\\\"b\" 70000\n";
+  TokenScanner scanner(std::string_view{pgn});
+  std::vector<Token> tokens(10);
+  tokens.resize(scanner.next_batch(tokens));
+  assert(tokens.size() == 6);
+  assert(tokens[0].kind == TokenKind::Integer && tokens[0].number == 12);
+  assert(tokens[1].kind == TokenKind::Period && tokens[1].offset == 2 && tokens[1].length == 1);
+  assert(tokens[2].kind == TokenKind::Symbol && scanner.text(tokens[2]) == "Nf3");
+  assert(tokens[3].kind == TokenKind::BraceComment && scanner.text(tokens[3]) == "{ abc }");
+  assert(tokens[4].kind == TokenKind::String && (tokens[4].flags & Token::ESCAPED));
+  assert(scanner.text(tokens[4]) == "a\\\"b");
+  std::string scratch;
+  assert(unescape(tokens[4], scanner.text(tokens[4]), scratch) == "a\"b");
+  assert(tokens[5].number == UINT16_MAX);
+  assert(scanner.next_batch(tokens) == 0);
+
+  // the end of the input terminates a symbol just like a separator does
+  for (size_t piece : {1, 2, 100})
+  {
+    const std::string unterminated = "1. e4 e5 ;comment";
+    TrickleSource source(unterminated, piece);
+    TokenScanner trickle_scanner(source);
+    const auto values = scan_values(trickle_scanner);
+    assert(values.size() == 5);
+    assert(values[3] == "SymbolToken:e5");
+    assert(values[4] == "LineComment");
+  }
+}
+
+void test_read_ahead()
+{
+  std::string pgn;
+  for (size_t i = 0; pgn.size() < 100000; ++i)
+    pgn.append(std::to_string(i)).append(". Nf3 {").append(i % 100, 'c').append("} Nf6 ");
+  TokenScanner plain_scanner(std::string_view{pgn});
+  const auto values = scan_values(plain_scanner);
+
+  for (size_t blocks : {1, 2, 4})
+  {
+    for (size_t block_size : {1, 100, 65536})
+    {
+      ReadAheadSource source(std::make_unique<TrickleSource>(pgn, 777), blocks, block_size);
+      TokenScanner scanner(source);
+      assert(scan_values(scanner) == values);
+    }
+  }
+
+  // the reader thread is stopped when the consumer goes away early
+  {
+    ReadAheadSource source(std::make_unique<TrickleSource>(pgn, 10), 2, 100);
+    char c;
+    const size_t n = source.read(&c, 1);
+    assert(n == 1 && c == '0');
+  }
+
+  // the state of the wrapped source is taken by the reader thread and handed over with the blocks
+  {
+    struct BadSource : public ByteSource
+    {
+      bool done = false;
+      size_t read(char* dst, size_t size) override
+      {
+        if (std::exchange(done, true))
+          return 0;
+        std::memset(dst, ' ', size);
+        return size;
+      }
+      bool bad() const override { return done; }
+    };
+    ReadAheadSource source(std::make_unique<BadSource>(), 2, 10);
+    std::vector<char> buffer(10);
+    while (source.read(buffer.data(), buffer.size()) != 0)
+    {
+    }
+    assert(source.bad());
+  }
+
+  // read errors reach the consumer after the blocks read before them
+  struct FailingSource : public ByteSource
+  {
+    size_t calls = 0;
+    size_t read(char* dst, size_t size) override
+    {
+      if (++calls > 3)
+        throw std::runtime_error("disk is gone");
+      std::memset(dst, ' ', size);
+      return size;
+    }
+  };
+  ReadAheadSource source(std::make_unique<FailingSource>(), 2, 10);
+  std::vector<char> buffer(10);
+  for (size_t i = 0; i < 3; ++i)
+  {
+    const size_t n = source.read(buffer.data(), buffer.size());
+    assert(n == 10);
+  }
+  bool thrown = false;
+  try
+  {
+    source.read(buffer.data(), buffer.size());
+  }
+  catch (const std::runtime_error& e)
+  {
+    thrown = std::string(e.what()) == "disk is gone";
+  }
+  assert(thrown);
+}
+
+#ifdef CHESS_REPLAY_HAS_ZLIB
+std::string gzip_compress(std::string_view input)
+{
+  z_stream stream{};
+  // 16 asks for a gzip header instead of a zlib one
+  int r = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  assert(r == Z_OK);
+  std::string output(deflateBound(&stream, input.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  stream.next_out = reinterpret_cast<Bytef*>(output.data());
+  stream.avail_out = output.size();
+  r = deflate(&stream, Z_FINISH);
+  assert(r == Z_STREAM_END);
+  output.resize(stream.total_out);
+  deflateEnd(&stream);
+  return output;
+}
+#endif
+
+#ifdef CHESS_REPLAY_HAS_BZIP2
+std::string bzip2_compress(std::string_view input)
+{
+  unsigned size = input.size() + input.size() / 100 + 600;
+  std::string output(size, '\0');
+  int r = BZ2_bzBuffToBuffCompress(output.data(), &size, const_cast<char*>(input.data()),
+                                   input.size(), 9, 0, 0);
+  assert(r == BZ_OK);
+  output.resize(size);
+  return output;
+}
+#endif
+
+#ifdef CHESS_REPLAY_HAS_ZSTD
+std::string zstd_compress(std::string_view input)
+{
+  std::string output(ZSTD_compressBound(input.size()), '\0');
+  size_t size = ZSTD_compress(output.data(), output.size(), input.data(), input.size(), 3);
+  assert(!ZSTD_isError(size));
+  output.resize(size);
+  return output;
+}
+#endif
+
+void test_decompression()
+{
+  std::string pgn;
+  for (size_t i = 0; pgn.size() < 3 * DecompressingSource::BLOCK_SIZE; ++i)
+    pgn.append(std::to_string(i)).append(". Nf3 {").append(i % 100, 'c').append("} Nf6 ");
+  pgn.append("*");
+
+  TokenScanner plain_scanner(std::string_view{pgn});
+  const auto values = scan_values(plain_scanner);
+
+  // uncompressed input is passed through untouched, even when shorter than the magic
+  for (std::string_view input : {std::string_view{pgn}, std::string_view{"*"}})
+  {
+    Compression detected;
+    auto source = open_decompressed(std::make_unique<TrickleSource>(input, 3), &detected);
+    assert(detected == Compression::NONE);
+    TokenScanner scanner(*source);
+    TokenScanner expected_scanner(input);
+    assert(scan_values(scanner) == scan_values(expected_scanner));
+  }
+
+  std::vector<std::pair<Compression, std::string>> compressed;
+#ifdef CHESS_REPLAY_HAS_ZLIB
+  // concatenated members, as written by pigz or `cat a.gz b.gz`
+  const std::string half = pgn.substr(0, pgn.size() / 2);
+  compressed.emplace_back(Compression::GZIP,
+                          gzip_compress(half) + gzip_compress(pgn.substr(half.size())));
+#endif
+#ifdef CHESS_REPLAY_HAS_BZIP2
+  compressed.emplace_back(Compression::BZIP2, bzip2_compress(pgn));
+#endif
+#ifdef CHESS_REPLAY_HAS_ZSTD
+  compressed.emplace_back(Compression::ZSTD, zstd_compress(pgn));
+#endif
+
+  for (const auto& [compression, data] : compressed)
+  {
+    assert(detect_compression(data.data(), data.size()) == compression);
+    for (size_t piece : {size_t{1}, size_t{4096}, data.size()})
+    {
+      Compression detected;
+      auto source = open_decompressed(std::make_unique<TrickleSource>(data, piece), &detected);
+      assert(detected == compression);
+      TokenScanner scanner(*source);
+      assert(scan_values(scanner) == values);
+    }
+
+    // a cut off file is an error rather than a silently shorter game
+    bool thrown = false;
+    try
+    {
+      DecompressingSource source(
+        std::make_unique<TrickleSource>(std::string_view{data}.substr(0, data.size() / 2), 4096),
+        compression);
+      TokenScanner scanner(source);
+      scan_values(scanner);
+    }
+    catch (const std::runtime_error&)
+    {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+}
+
+const std::vector<std::string>& mixed_games()
+{
+  static const std::vector<std::string> games{
+    "[Event \"A\"]\n[Result \"1-0\"]\n\n1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 4. Ba4 Nf6 5. O-O Be7 "
+    "1-0\n\n",
+    // the next game follows the result with no blank line
+    "[Event \"B\"]\r\n\r\n1. d4 d5 (1... Nf6 2. c4) 2. c4 e6 $1 1/2-1/2\n",
+    "{ between games }\n[Event \"C\"]\n[Site \"x\"]\n\n1. e4 c5 2. Nf3 d6 3. d4 cxd4 4. Nxd4 "
+    "Nf6\n5. Nc3 a6 *\n\n",
+    "1. f3 e5 2. g4 Qh4# 0-1\n\n"};
+  return games;
+}
+
+// the games above in a shuffled order: 0, 3, 2, 1, 0, ...
+std::string mixed_games_pgn(size_t count)
+{
+  std::string pgn;
+  for (size_t i = 0; i < count; ++i)
+    pgn.append(mixed_games()[(i * 7) % mixed_games().size()]);
+  return pgn;
+}
+
+void test_parallel_replay()
+{
+  const auto& games = mixed_games();
+  const std::string pgn = mixed_games_pgn(200);
+
+  auto summarize = [](const GameRecord& record, const ChessBoard& board)
+  {
+    std::stringstream o;
+    o << record.offset << " " << record.plies << " " << (int)record.result << "\n" << board;
+    return o.str();
+  };
+
+  std::vector<std::string> sequential;
+  TokenScanner scanner(std::string_view{pgn});
+  const bool unfinished =
+    replay_games(scanner, 0, [&](const GameRecord& record, const ChessBoard& board)
+                 { sequential.push_back(summarize(record, board)); });
+  assert(!unfinished);
+  assert(sequential.size() == 200);
+  assert(sequential[0].starts_with("0 10 1\n"));
+
+  // the board and the parser are reset cleanly between games, so the same game gives the same
+  // position wherever it is in the file
+  auto position = [](const std::string& summary) { return summary.substr(summary.find('\n')); };
+  for (size_t i = 4; i < sequential.size(); ++i)
+    assert(position(sequential[i]) == position(sequential[i - 4]));
+  ChessBoard board;
+  board.apply(MoveFactory()("e4", true));
+  board.reset();
+  std::stringstream reset_board, new_board;
+  reset_board << board;
+  new_board << ChessBoard{};
+  assert(reset_board.str() == new_board.str());
+
+  for (size_t threads : {1, 2, 3, 7, 64, 1000})
+  {
+    bool unfinished = true;
+    const auto parallel =
+      replay_games_parallel(pgn.data(), pgn.data() + pgn.size(), threads, summarize, &unfinished);
+    assert(parallel == sequential && !unfinished);
+  }
+
+  // a game cut short at the end is reported whatever the number of threads
+  const std::string cut = pgn + "[Event \"cut\"]\n\n1. e4 e5";
+  for (size_t threads : {1, 2, 7})
+  {
+    bool unfinished = false;
+    const auto parallel =
+      replay_games_parallel(cut.data(), cut.data() + cut.size(), threads, summarize, &unfinished);
+    assert(parallel.size() == sequential.size() && unfinished);
+  }
+
+  // the ranges start at games the lexer finds, so a blank line followed by a tag or a line ending
+  // with a result inside of a comment does not cut a game in two
+  std::string commented;
+  for (size_t i = 0; i < 101; ++i)
+  {
+    commented += "[Event \"" + std::to_string(i) + "\"]\n\n1. e4 e5 ";
+    if (i == 50)
+    {
+      commented += "{a long note " + std::string(2000, 'x');
+      commented += "\n\n[Event \"fake\"]\n\n1. d4 *\n}\n";
+    }
+    commented += "2. Nf3 Nc6 1-0\n\n";
+  }
+  std::vector<std::string> one_pass;
+  TokenScanner commented_scanner(std::string_view{commented});
+  replay_games(commented_scanner, 0, [&](const GameRecord& record, const ChessBoard& board)
+               { one_pass.push_back(summarize(record, board)); });
+  assert(one_pass.size() == 101);
+  for (size_t threads : {2, 3, 4, 8, 64})
+  {
+    bool cut_short = true;
+    const auto parallel = replay_games_parallel(commented.data(),
+                                                commented.data() + commented.size(), threads,
+                                                summarize, &cut_short);
+    assert(parallel == one_pass && !cut_short);
+  }
+}
+
+void test_game_index()
+{
+  const std::string pgn = mixed_games_pgn(100);
+  const char* data = pgn.data();
+  const auto games = build_game_index(data, data + pgn.size());
+  assert(games.size() == 100);
+
+  // the same games as the replay finds
+  std::vector<GameRecord> records;
+  TokenScanner scanner(std::string_view{pgn});
+  replay_games(scanner, 0, [&](const GameRecord& record, const ChessBoard&)
+               { records.push_back(record); });
+  assert(records.size() == games.size());
+  for (size_t i = 0; i < games.size(); ++i)
+  {
+    assert(games[i].offset == records[i].offset);
+    const std::string_view game(data + games[i].offset, games[i].length);
+    const std::string_view movetext = game.substr(games[i].movetext);
+    assert(movetext.starts_with("1. "));
+    assert(game.ends_with("1-0") || game.ends_with("0-1") || game.ends_with("1/2-1/2") ||
+           game.ends_with("*"));
+  }
+  assert(games[0].offset == 0 && games[0].movetext == 28);
+  assert(games[1].movetext == 0);
+  assert(data[games[2].offset] == '[');
+
+  // a game with no result ends at the tags of the next one, as the lenient replay resyncs
+  {
+    const std::string cut = "[Event \"a\"]\n\n1. e4 e5\n\n[Event \"b\"]\n\n1. d4 d5 1-0\n";
+    const auto split = build_game_index(cut.data(), cut.data() + cut.size());
+    assert(split.size() == 2);
+    assert(std::string_view(cut.data(), split[0].length) == "[Event \"a\"]\n\n1. e4 e5");
+    assert(split[0].movetext == 13);
+    assert(split[1].offset == cut.find("[Event \"b\"]") && split[1].movetext == 13);
+  }
+
+  // built and saved on the first use, mapped from the sidecar afterwards
+  char dir_template[] = "/tmp/chess_replay_tests_XXXXXX";
+  const std::string dir = ::mkdtemp(dir_template);
+  const std::string path = dir + "/games.pgn";
+  std::ofstream(path) << pgn;
+  {
+    GameIndex index(path, data, pgn.size());
+    assert(!index.loaded_from_sidecar());
+    assert(std::ranges::equal(index.games(), games, [](auto& a, auto& b)
+                              { return std::memcmp(&a, &b, sizeof(a)) == 0; }));
+  }
+  {
+    GameIndex index(path, data, pgn.size());
+    assert(index.loaded_from_sidecar());
+    assert(index.size() == games.size() && index[99].offset == games[99].offset);
+
+    // ranges of about the same size replay the same games as one pass does
+    const auto offsets = index.split(4, pgn.size());
+    assert(offsets.size() == 5 && offsets.back() == pgn.size());
+    std::vector<const char*> bounds;
+    for (uint64_t offset : offsets)
+      bounds.push_back(data + offset);
+    const auto parallel = replay_games_parallel(data, bounds, [](const GameRecord& record, auto&)
+                                                { return record.offset; });
+    assert(parallel.size() == records.size() && parallel[50] == records[50].offset);
+  }
+
+  // a count corrupted so that its size in bytes wraps around to the real one is not trusted
+  {
+    const std::string sidecar = GameIndex::sidecar_path(path);
+    std::fstream file(sidecar, std::ios::in | std::ios::out | std::ios::binary);
+    GameIndexHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    header.count += uint64_t(1) << 60;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+  {
+    GameIndex index(path, data, pgn.size());
+    assert(!index.loaded_from_sidecar() && index.size() == games.size());
+  }
+
+  // a different file size invalidates the sidecar
+  const std::string longer = pgn + mixed_games()[0];
+  std::ofstream(path) << longer;
+  {
+    GameIndex index(path, longer.data(), longer.size());
+    assert(!index.loaded_from_sidecar() && index.size() == 101);
+  }
+  std::remove(GameIndex::sidecar_path(path).c_str());
+  std::remove(path.c_str());
+  ::rmdir(dir.c_str());
+}
+
+void test_headers()
+{
+  std::string pgn = mixed_games_pgn(20);
+  // tags inside of comments do not start a game
+  pgn.append("[Event \"D\"]\n[White \"a \\\"b\\\"\"]\n[Opening \"Sicilian\"]\n\n"
+             "1. e4 {\n[Event \"x\"]\n} c5 ; { [Event\n%[Event \"y\"]\n2. Nf3 *\n\n");
+
+  std::vector<GameHeaders> fast;
+  scan_headers(pgn.data(), pgn.data() + pgn.size(),
+               [&](const GameHeaders& headers) { fast.push_back(headers); });
+  std::vector<GameHeaders> streamed;
+  TrickleSource source(pgn, 333);
+  TokenScanner scanner(source);
+  scan_headers(scanner, [&](const GameHeaders& headers) { streamed.push_back(headers); });
+
+  // the games without tags are not reported
+  assert(fast.size() == 16);
+  assert(streamed.size() == fast.size());
+  std::string scratch;
+  auto values = [&scratch](const GameHeaders& headers)
+  {
+    std::vector<std::string> pairs;
+    for (const TagSpan& tag : headers.tags())
+      pairs.push_back(std::string(headers.name(tag)) + "=" +
+                      std::string(headers.value(tag, scratch)));
+    return pairs;
+  };
+  for (size_t i = 0; i < fast.size(); ++i)
+  {
+    assert(fast[i].offset == streamed[i].offset && fast[i].movetext == streamed[i].movetext);
+    assert(values(fast[i]) == values(streamed[i]));
+    assert(pgn[fast[i].offset] == '[');
+  }
+  assert(fast[0].value("Event", scratch) == "A" && fast[0].value("Result", scratch) == "1-0");
+  assert(fast[0].movetext == 28);
+  assert(fast[1].value("Event", scratch) == "C" && fast[1].value("Site", scratch) == "x");
+  assert(fast[2].value("Event", scratch) == "B");
+  const GameHeaders& last = fast.back();
+  assert(last.value("Event", scratch) == "D" && last.value("White", scratch) == "a \"b\"");
+  assert(last.raw_value(*last.find("White")) == "a \\\"b\\\"");
+  assert(last.tags().size() == 3 && last.name(last.tags()[2]) == "Opening");
+  assert(!last.find("Date") && last.value("Date", scratch).empty());
+  assert(pgn.substr(last.movetext, 5) == "1. e4");
+}
+
+void test_tag_projection()
+{
+  const std::string pgn = "[Event \"E\"]\n[Date \"1992.11.??\"]\n[WhiteElo \"2785\"]\n"
+                          "[BlackElo \"?\"]\n[EventDate \"1992\"]\n[ECO \"B\\\\20\"]\n\n1. e4 *\n";
+  GameHeaders headers;
+  scan_headers(pgn.data(), pgn.data() + pgn.size(),
+               [&](const GameHeaders& h) { headers = h; });
+  assert(headers.tags().size() == 6);
+
+  // the copy keeps pointing into the same input, decoding happens on request only
+  assert(headers.integer("WhiteElo") == 2785);
+  assert(!headers.integer("BlackElo") && !headers.integer("Event") && !headers.integer("Nope"));
+  auto date = headers.date("Date");
+  assert(date && date->year == 1992 && date->month == 11 && date->day == 0);
+  assert(!headers.date("EventDate") && !headers.date("Event"));
+
+  const auto columns = parse_tag_projection("WhiteElo:int,BlackElo:int,ECO,Date:date,Round");
+  assert(columns.size() == 5 && columns[0].name == "WhiteElo");
+  assert(columns[0].kind == TagColumn::INTEGER && columns[2].kind == TagColumn::TEXT);
+  assert(columns[3].kind == TagColumn::DATE);
+  std::ostringstream out;
+  std::string scratch;
+  for (const TagColumn& column : columns)
+  {
+    write_tag(out, headers, column, scratch);
+    out << '|';
+  }
+  assert(out.str() == "2785||B\\20|1992-11-??||");
+
+  bool thrown = false;
+  try
+  {
+    parse_tag_projection("WhiteElo:float");
+  }
+  catch (const std::runtime_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+// writes every event down, so the order of callbacks can be checked as well
+struct EventLog
+{
+  std::vector<std::string> events;
+
+  void on_tag(std::string_view name, std::string_view value)
+  {
+    events.push_back(std::string("tag ").append(name).append("=").append(value));
+  }
+  void on_move(std::string_view san, bool white, unsigned depth)
+  {
+    events.push_back(std::string(white ? "w " : "b ").append(san).append(depth, '\''));
+  }
+  void on_comment(std::string_view text) { events.push_back(std::string("{").append(text)); }
+  void on_nag(unsigned nag) { events.push_back("$" + std::to_string(nag)); }
+  void on_variation_begin() { events.push_back("("); }
+  void on_variation_end() { events.push_back(")"); }
+  void on_result(TerminationMarker result) { events.push_back(result_name(result)); }
+};
+
+struct ResultCounter
+{
+  size_t games = 0;
+  void on_result(TerminationMarker) { ++games; }
+};
+
+void test_pgn_events()
+{
+  const std::string pgn = "{before} [Event \"a \\\"b\\\"\"]\n[Site \"x\"]\n\n"
+                          "1. e4 $1 {a long comment that has to survive a refill} e5 "
+                          "(1... c5 $14 2. Nf3 (2. c3 d5) d6) 2. Nf3 ; line\n"
+                          "Nc6 1-0\n\n1. d4 d5 *\n";
+  const std::vector<std::string> expected{
+    "{before", "tag Event=a \"b\"", "tag Site=x", "w e4", "$1",
+    "{a long comment that has to survive a refill", "b e5", "(", "b c5'", "$14", "w Nf3'", "(",
+    "w c3''", "b d5''", ")", "b d6'", ")", "w Nf3", "{ line", "b Nc6", "1-0", "w d4", "b d5",
+    "*"};
+
+  EventLog mapped;
+  TokenScanner scanner(pgn);
+  parse_pgn(scanner, mapped);
+  assert(mapped.events == expected);
+
+  // comments are kept across refills of a streamed window once a handler wants them
+  for (size_t piece : {size_t{1}, size_t{7}, pgn.size()})
+  {
+    EventLog streamed;
+    TrickleSource source(pgn, piece);
+    TokenScanner trickle_scanner(source);
+    parse_pgn(trickle_scanner, streamed);
+    assert(streamed.events == expected);
+  }
+
+  // `e.p.` after an en passant capture is no ply, in the main line or in a variation
+  const std::string en_passant =
+    "1. e4 d5 2. e5 f5 3. exf6 e.p. (3. d4 c5 4. dxc6 e.p. Nf6) 3... Nxf6 1-0";
+  EventLog suffixed;
+  TokenScanner en_passant_scanner(en_passant);
+  parse_pgn(en_passant_scanner, suffixed);
+  assert((suffixed.events ==
+          std::vector<std::string>{"w e4", "b d5", "w e5", "b f5", "w exf6", "(", "w d4'",
+                                   "b c5'", "w dxc6'", "b Nf6'", ")", "b Nxf6", "1-0"}));
+
+  // a handler with only on_result sees every game, the mixed file has 100 of them
+  const std::string games = mixed_games_pgn(100);
+  ResultCounter counter;
+  TokenScanner games_scanner(games);
+  parse_pgn(games_scanner, counter);
+  assert(counter.games == 100);
+
+  // the parser reports the same moves it replays
+  EventLog log;
+  PGNParser parser;
+  TokenScanner replay_scanner(pgn);
+  size_t moves = 0;
+  for (const auto& token : replay_scanner)
+  {
+    auto action = parser.consume_token(token, replay_scanner.text(token), log);
+    if (action && std::holds_alternative<NextMove>(*action))
+      ++moves;
+    if (action && std::holds_alternative<Finish>(*action))
+      break;
+  }
+  assert(moves == 4 && log.events.back() == "1-0");
+}
+
+void test_pgn_games()
+{
+  const std::string pgn = mixed_games_pgn(100);
+  struct Replayed
+  {
+    GameRecord record;
+    std::string board;
+  };
+  std::vector<Replayed> replayed;
+  TokenScanner replay_scanner(pgn);
+  replay_games(replay_scanner, 0, [&](const GameRecord& record, const ChessBoard& board)
+               {
+                 std::ostringstream out;
+                 out << board;
+                 replayed.push_back({record, out.str()});
+               });
+
+  // every move pulled and applied gives the same games as replay_games
+  for (size_t piece : {size_t{5}, pgn.size()})
+  {
+    TrickleSource source(pgn, piece);
+    TokenScanner scanner(source);
+    size_t i = 0;
+    for (PgnGame& game : pgn_games(scanner))
+    {
+      assert(i < replayed.size() && game.offset() == replayed[i].record.offset);
+      ChessBoard board;
+      uint32_t plies = 0;
+      for (const PgnMove& move : game.moves())
+      {
+        assert(move.ply == ++plies && move.white == (plies % 2 == 1));
+        assert(!move.san.empty());
+        board.apply(move.move);
+      }
+      assert(game.finished() && game.result() == replayed[i].record.result);
+      assert(plies == replayed[i].record.plies);
+      std::ostringstream out;
+      out << board;
+      assert(out.str() == replayed[i].board);
+      ++i;
+    }
+    assert(i == replayed.size());
+  }
+
+  // games pulled partly or not at all are skipped up to their end
+  TokenScanner scanner(pgn);
+  size_t games = 0;
+  std::string scratch;
+  for (PgnGame& game : pgn_games(scanner))
+  {
+    assert(game.offset() == replayed[games].record.offset);
+    const std::string_view event = game.headers().value("Event", scratch);
+    if (games % 4 == 0)
+      assert(event == "A");
+    if (games++ % 2 == 1)
+      continue;
+    size_t pulled = 0;
+    for (const PgnMove& move : game.moves())
+    {
+      if (pulled++ == 0)
+        assert(move.san == "e4" || move.san == "f3" || move.san == "d4");
+      if (pulled == 2)
+        break;
+    }
+    assert(!game.finished());
+  }
+  assert(games == 100);
+
+  // black moves first from a [FEN] position with black to move, or after a `1...` number
+  const std::string from_position =
+    "[Event \"A\"]\n[SetUp \"1\"]\n"
+    "[FEN \"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1\"]\n\n"
+    "1... e5 2. Nf3 Nc6 *\n\n"
+    "[Event \"B\"]\n\n1. e4 e5 *\n\n"
+    "[Event \"C\"]\n\n1... e5 2. Nf3 *\n";
+  const std::vector<std::vector<bool>> sides{
+    {false, true, false}, {true, false}, {false, true}};
+  TokenScanner position_scanner(from_position);
+  size_t position_games = 0;
+  for (PgnGame& game : pgn_games(position_scanner))
+  {
+    std::vector<bool> white;
+    for (const PgnMove& move : game.moves())
+      white.push_back(move.white);
+    assert(white == sides[position_games++]);
+  }
+  assert(position_games == sides.size());
+
+  // a file is mapped or streamed through the decompressor
+  char dir_template[] = "/tmp/chess_replay_tests_XXXXXX";
+  const std::string dir = ::mkdtemp(dir_template);
+  std::vector<std::string> paths{dir + "/games.pgn"};
+  std::ofstream(paths[0]) << pgn;
+#ifdef CHESS_REPLAY_HAS_ZLIB
+  paths.push_back(dir + "/games.pgn.gz");
+  std::ofstream(paths[1]) << gzip_compress(pgn);
+#endif
+  for (const std::string& path : paths)
+  {
+    size_t count = 0;
+    for (PgnGame& game : pgn_games(path))
+      count += game.offset() == replayed[count].record.offset;
+    assert(count == 100);
+    std::remove(path.c_str());
+  }
+  ::rmdir(dir.c_str());
+
+  // the frame of a finished generator goes to the next one of the same size
+  FrameCache cache;
+  void* frame = cache.allocate(100);
+  cache.release(frame, 100);
+  void* again = cache.allocate(100);
+  assert(again == frame);
+  ::operator delete(again);
+}
+
+std::string board_after(const std::string& pgn)
+{
+  TokenScanner scanner(pgn);
+  std::string text;
+  replay_games(scanner, 0, [&](const GameRecord&, const ChessBoard& board)
+               {
+                 std::ostringstream out;
+                 out << board;
+                 text = out.str();
+               });
+  return text;
+}
+
+void test_move_tree()
+{
+  // the journal takes back captures, castling, en passant and promotions alike
+  {
+    const std::string moves = "1. e4 d5 2. exd5 c5 3. dxc6 Nf6 4. cxb7 e6 5. bxa8=Q Be7 6. Nf3 O-O";
+    ChessBoard board;
+    std::ostringstream initial;
+    initial << board;
+    board.set_journaling(true);
+    const size_t start = board.mark();
+    TokenScanner scanner(moves);
+    PGNParser parser;
+    for (const auto& token : scanner)
+    {
+      if (auto action = parser.consume_token(token, scanner.text(token)))
+        board.apply(*action);
+    }
+    std::ostringstream played;
+    played << board;
+    assert(played.str() == board_after(moves + " *"));
+    board.undo(start);
+    std::ostringstream undone;
+    undone << board;
+    assert(undone.str() == initial.str());
+  }
+
+  const std::string pgn = "[Event \"RAV\"]\n\n1. e4 e5 (1... c5 2. Nf3 (2. c3 d5) d6) (1... e6 $1) "
+                          "2. Nf3 {main} Nc6 (2... Nf6 3. d4 exd4) 3. Bb5 1-0\n\n"
+                          "( 1. d4 ) 1. d4 d5 2. c4 *\n";
+  MoveTree tree;
+  std::vector<GameRecord> records;
+  std::vector<std::string> lines;
+  TokenScanner scanner(pgn);
+  read_move_trees(scanner, 0, tree,
+                  [&](const GameRecord& record, const MoveTree& game)
+                  {
+                    records.push_back(record);
+                    ChessBoard board;
+                    std::string played;
+                    replay_tree(game, board,
+                                [&](const MoveNode&, std::string_view san, const ChessBoard&,
+                                    unsigned depth)
+                                { played.append(std::string(san)).append(depth, '\'').append(" "); });
+                    lines.push_back(played);
+
+                    // the board ends at the main line, as if there were no variations
+                    std::ostringstream out;
+                    out << board;
+                    lines.push_back(out.str());
+                  });
+  assert(records.size() == 2 && lines.size() == 4);
+  assert(records[0].plies == 5 && records[0].result == TerminationMarker::WHITE_WON);
+  assert(lines[0] == "e4 c5' c3'' d5'' Nf3' d6' e6' e5 Nf3 Nf6' d4' exd4' Nc6 Bb5 ");
+  assert(lines[1] == board_after("1. e4 e5 2. Nf3 Nc6 3. Bb5 *"));
+  // a variation before the first move has nothing to replace
+  assert(records[1].plies == 3 && lines[2] == "d4 d5 c4 ");
+
+  // every variation move is played from its branch point
+  MoveTree first;
+  TokenScanner first_scanner(pgn);
+  read_move_trees(first_scanner, 0, tree, [&](const GameRecord& record, const MoveTree& game)
+                  {
+                    if (record.offset == 0)
+                      first = game;
+                  });
+  const std::vector<std::pair<std::string, std::string>> expected{
+    {"c3", "1. e4 c5 2. c3 *"}, {"d5", "1. e4 c5 2. c3 d5 *"}, {"d6", "1. e4 c5 2. Nf3 d6 *"},
+    {"e6", "1. e4 e6 *"}, {"exd4", "1. e4 e5 2. Nf3 Nf6 3. d4 exd4 *"}};
+  size_t checked = 0;
+  ChessBoard board;
+  replay_tree(first, board,
+              [&](const MoveNode&, std::string_view san, const ChessBoard& position, unsigned depth)
+              {
+                for (const auto& [move, line] : expected)
+                {
+                  if (depth > 0 && san == move)
+                  {
+                    std::ostringstream out;
+                    out << position;
+                    assert(out.str() == board_after(line));
+                    ++checked;
+                  }
+                }
+              });
+  assert(checked == expected.size());
+
+  // the same games, plies and final boards as replay_games for files with variations
+  const std::string games = mixed_games_pgn(40);
+  std::vector<std::string> replayed;
+  TokenScanner replay_scanner(games);
+  replay_games(replay_scanner, 0, [&](const GameRecord& record, const ChessBoard& position)
+               {
+                 std::ostringstream out;
+                 out << record.offset << " " << record.plies << " " << position;
+                 replayed.push_back(out.str());
+               });
+  std::vector<std::string> from_trees;
+  TokenScanner tree_scanner(games);
+  read_move_trees(tree_scanner, 0, tree, [&](const GameRecord& record, const MoveTree& game)
+                  {
+                    ChessBoard position;
+                    replay_tree(game, position, [](auto&&...) {});
+                    std::ostringstream out;
+                    out << record.offset << " " << record.plies << " " << position;
+                    from_trees.push_back(out.str());
+                  });
+  assert(from_trees == replayed);
+}
+
+void test_annotations()
+{
+  static_assert(!WantsComments<MoveTreeBuilder>);
+  static_assert(WantsComments<AnnotatedMoveTreeBuilder>);
+
+  const std::string pgn = "[Event \"N\"]\n\n{opening} 1. e4 $1 {best by test} e5 "
+                          "( {or} 1... c5 $14 {Sicilian} ) 2. Nf3 ; line\nNc6 $2 $4 *\n";
+  auto describe = [&pgn](const MoveTree& tree)
+  {
+    std::vector<std::string> notes;
+    for (uint32_t i = 0; i < tree.size(); ++i)
+    {
+      std::string note(tree.san(tree[i]));
+      tree.for_each_annotation(tree[i],
+                               [&](const Annotation& annotation)
+                               {
+                                 note += annotation.before ? " <" : " ";
+                                 if (annotation.kind == Annotation::NAG)
+                                   note += "$" + std::to_string(annotation.nag);
+                                 else
+                                   note += "{" + std::string(MoveTree::text(annotation, pgn.data())) +
+                                           "}";
+                               });
+      notes.push_back(note);
+    }
+    return notes;
+  };
+  const std::vector<std::string> expected{"e4 <{opening} $1 {best by test}", "e5",
+                                          "c5 <{or} $14 {Sicilian}", "Nf3 { line}", "Nc6 $2 $4"};
+
+  MoveTree tree;
+  std::vector<std::string> mapped;
+  TokenScanner scanner(pgn);
+  read_move_trees<true>(scanner, 0, tree,
+                        [&](const GameRecord&, const MoveTree& game) { mapped = describe(game); });
+  assert(mapped == expected);
+  assert(tree.annotation_count() == 9);
+
+  // a streamed input gives the same spans, which point into the input and not into the window
+  for (size_t piece : {size_t{1}, size_t{3}})
+  {
+    std::vector<std::string> streamed;
+    TrickleSource source(pgn, piece);
+    TokenScanner trickle_scanner(source);
+    read_move_trees<true>(trickle_scanner, 0, tree, [&](const GameRecord&, const MoveTree& game)
+                          { streamed = describe(game); });
+    assert(streamed == expected);
+  }
+
+  // off by default
+  TokenScanner plain_scanner(pgn);
+  read_move_trees(plain_scanner, 0, tree,
+                  [&](const GameRecord&, const MoveTree& game)
+                  { assert(game.size() == 5 && game.annotation_count() == 0); });
+}
+
+void test_scan_kernels()
+{
+  // every position of the needle / first non-separator against every available kernel
+  std::vector<ScanKernels> kernels{{"scalar", skip_separators_scalar, find_char_scalar}};
+#if CHESS_REPLAY_X86
+  if (__builtin_cpu_supports("sse4.2"))
+    kernels.push_back({"sse4.2", skip_separators_sse42, find_char_sse42});
+  if (__builtin_cpu_supports("avx2"))
+    kernels.push_back({"avx2", skip_separators_avx2, find_char_avx2});
+#endif
+
+  const std::string separators = " \n\t\r";
+  for (size_t size = 0; size <= 100; ++size)
+  {
+    for (size_t pos = 0; pos <= size; ++pos)
+    {
+      std::string spaces(size, ' ');
+      std::string comment(size, 'x');
+      for (size_t i = 0; i < pos; ++i)
+        spaces[i] = separators[i % separators.size()];
+      if (pos < size)
+      {
+        spaces[pos] = 'e';
+        comment[pos] = '}';
+      }
+
+      for (const auto& k : kernels)
+      {
+        const char* b = spaces.data();
+        assert(k.skip_separators(b, b + size) == b + pos);
+        b = comment.data();
+        assert(k.find_char(b, b + size, '}') == b + pos);
+      }
+    }
+  }
+}
+
 void integration_tests()
 {
   //#1
@@ -1287,9 +2347,449 @@ wP|  |  |  |  |wP|  |
   }
 }
 
+void test_commands()
+{
+  auto parse = [](std::string_view comment)
+  {
+    MoveCommands move;
+    parse_commands(comment, move);
+    return move;
+  };
+  constexpr int32_t NONE = MoveCommands::NONE;
+
+  MoveCommands move = parse(" [%eval 0.17] [%clk 0:03:00] ");
+  assert(move.eval == 17 && move.clock == 180000 && move.elapsed == NONE);
+  move = parse("[%clk 1:02:03.5][%emt 0:00:07.25] good move [%eval -1.5,22]");
+  assert(move.clock == 3723500 && move.elapsed == 7250 && move.eval == -150);
+  assert(parse("[%eval #3]").eval == MoveCommands::MATE - 3);
+  assert(parse("[%eval #-2]").eval == -(MoveCommands::MATE - 2));
+  assert(is_mate(parse("[%eval #-2]").eval) && mate_in(parse("[%eval #-2]").eval) == -2);
+  assert(!is_mate(parse("[%eval -310.45]").eval) && parse("[%eval -310.45]").eval == -31045);
+  assert(parse("[%eval .5]").eval == 50 && parse("[%eval +2]").eval == 200);
+  assert(parse("[%clk 45]").clock == 45000 && parse("[%clk 0:00:01.2345]").clock == 1234);
+
+  // malformed arguments, unknown commands and plain text are skipped
+  move = parse("[%clk 0:0x:00] [%eval abc] [%csl Ga4] [not a command] [%emt");
+  assert(move.clock == NONE && move.eval == NONE && move.elapsed == NONE);
+  assert(parse("[%eval #1.5]").eval == NONE && parse("[%clk ]").clock == NONE);
+
+  std::ostringstream out;
+  write_clock(out, 180000);
+  out << ' ';
+  write_clock(out, 3723500);
+  out << ' ';
+  write_clock(out, 1234);
+  out << ' ';
+  write_eval(out, 17);
+  out << ' ';
+  write_eval(out, -150);
+  out << ' ';
+  write_eval(out, -5);
+  out << ' ';
+  write_eval(out, MoveCommands::MATE - 3);
+  out << ' ';
+  write_eval(out, NONE);
+  assert(out.str() == "180 3723.5 1.234 0.17 -1.50 -0.05 #3 ");
+
+  // one entry per ply of the main line, whatever the comments and variations around it
+  const std::string pgn =
+    "[Event \"C\"]\n\n{start [%clk 0:09:59]} 1. e4 {[%eval 0.2] [%clk 0:03:00]} e5 "
+    "{[%clk 0:02:58]} (1... c5 {[%eval 0.4] [%clk 0:01:00]}) 2. Nf3 {no commands} Nc6 "
+    "{[%emt 0:00:04] [%clk 0:02:55]} 1-0\n\n1. d4 {[%eval #-4]} *\n\n"
+    // `e.p.` is no ply, the comment after it belongs to the capture
+    "1. e4 {[%clk 0:03:00]} d5 {[%clk 0:03:00]} 2. e5 {[%clk 0:02:59]} f5 {[%clk 0:02:58]} "
+    "3. exf6 e.p. {[%clk 0:02:57]} Nxf6 {[%clk 0:02:50]} 0-1\n";
+  auto replay = [](TokenScanner& scanner)
+  {
+    std::vector<std::string> games;
+    PlyCommands commands;
+    replay_games(
+      scanner, 0,
+      [&](const GameRecord& record, const ChessBoard&)
+      {
+        assert(commands.plies() == record.plies);
+        std::ostringstream game;
+        for (size_t i = 0; i < commands.plies(); ++i)
+        {
+          game << '|';
+          write_clock(game, commands.clock[i]);
+          game << ',';
+          write_clock(game, commands.elapsed[i]);
+          game << ',';
+          write_eval(game, commands.eval[i]);
+        }
+        games.push_back(game.str());
+        commands.clear();
+      },
+      commands);
+    return games;
+  };
+  const std::vector<std::string> expected{"|180,,0.20|178,,|,,|175,4,", "|,,#-4",
+                                          "|180,,|180,,|179,,|178,,|177,,|170,,"};
+
+  TokenScanner scanner(pgn);
+  assert(replay(scanner) == expected);
+  for (size_t piece : {size_t{1}, size_t{5}})
+  {
+    TrickleSource source(pgn, piece);
+    TokenScanner trickle_scanner(source);
+    assert(replay(trickle_scanner) == expected);
+  }
+}
+
+void test_lenient_replay()
+{
+  const std::string good = "[Event \"ok\"]\n\n1. e4 e5 2. Nf3 Nc6 1-0\n\n";
+  const std::vector<std::pair<std::string, std::string>> bad{
+    {"[Event \"illegal\"]\n\n1. e4 e5 2. Ke3 Nc6 0-1\n\n", "the move cannot be played at [Ke3]"},
+    {"[Event \"symbol\"]\n\n1. e4 Qxz 1/2-1/2\n\n", "bad symbol in next move: Qxz"},
+    {"[Event \"lexer\"]\n\n1. e4 @ e5 *\n\n", "malformed token at [@]"},
+    {"[Event \"unbalanced\"]\n\n1. e4 ) e5 (1... c5) 2. d4 1-0\n\n", "unbalanced parenthesis"},
+    {"[Event \"no result\"]\n\n1. d4 d5\n\n", "the game has no result"},
+    {"[Event \"tag\"] [Site]\n\n1. d4 d5 *\n\n", "cannot transition"},
+    {"[Event \"late\"]\n\n1. e4 (1. d4 d5) e5 2. Nf3 {a comment} Bb5 3. Nc3 0-1\n\n", "[Bb5]"},
+    {"[Event \"variation\"]\n\n1. e4 (1. d4 *) e5 1-0\n\n", "result inside of a variation at [*]"},
+    {"[Event \"variation\"]\n\n1. e4 (1. d4 d5 0-1) e5 1-0\n\n", "variation at [0-1]"}};
+
+  std::string pgn = good;
+  for (const auto& [game, reason] : bad)
+    pgn += game + good;
+
+  auto replay = [&](TokenScanner& scanner)
+  {
+    std::vector<std::string> log;
+    const bool unfinished = replay_games_lenient(
+      scanner, 0,
+      [&](const GameRecord& record, const ChessBoard& board)
+      {
+        std::ostringstream o;
+        o << "game " << record.offset << " " << record.plies << " " << result_name(record.result);
+        log.push_back(o.str());
+        ChessBoard expected;
+        for (const char* san : {"e4", "e5", "Nf3", "Nc6"})
+          expected.apply(MoveFactory()(san, san[0] == 'e' ? san[1] == '4' : san[1] == 'f'));
+        std::ostringstream a, b;
+        a << board;
+        b << expected;
+        assert(a.str() == b.str());
+      },
+      [&](const RejectedGame& game)
+      {
+        assert(game.offset < game.error_offset);
+        log.push_back("reject " + std::to_string(game.offset) + " " + std::string(game.reason));
+      });
+    assert(!unfinished);
+    return log;
+  };
+
+  TokenScanner scanner(pgn);
+  const std::vector<std::string> log = replay(scanner);
+  assert(log.size() == 2 * bad.size() + 1);
+  size_t offset = 0;
+  for (size_t i = 0; i < log.size(); ++i)
+  {
+    // every good game is replayed whatever came before it, the bad ones are given up at
+    // their first error and reported with where they start
+    const std::string& game = i % 2 ? bad[i / 2].first : good;
+    assert(log[i].starts_with((i % 2 ? "reject " : "game ") + std::to_string(offset) + " "));
+    if (i % 2)
+      assert(log[i].find(bad[i / 2].second) != std::string::npos);
+    else
+      assert(log[i].ends_with(" 4 1-0"));
+    offset += game.size();
+  }
+
+  for (size_t piece : {size_t{1}, size_t{7}})
+  {
+    TrickleSource source(pgn, piece);
+    TokenScanner trickle_scanner(source);
+    assert(replay(trickle_scanner) == log);
+  }
+
+  // the strict replay still stops at the first bad game
+  bool thrown = false;
+  try
+  {
+    TokenScanner strict_scanner(pgn);
+    replay_games(strict_scanner, 0, [](const GameRecord&, const ChessBoard&) {});
+  }
+  catch (const std::exception&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+void test_packed_moves()
+{
+  // every field of a decoded SAN survives packing
+  for (const char* san : {"e4", "h1", "a1=Q", "a7xb8=Q", "axb", "Nbxd7+", "R1e2#", "Qh4xe1",
+                          "b8(B)", "O-O", "O-O-O", "1-0", "0-1", "1/2-1/2", "e"})
+  {
+    for (bool white : {true, false})
+    {
+      const Moves move = MoveFactory()(san, white);
+      const PackedSan packed = pack(move);
+      assert(packed.index() == move.index());
+      const Moves unpacked = unpack(packed);
+      assert(pack(unpacked) == packed);
+      std::ostringstream a, b;
+      a << move;
+      b << unpacked;
+      assert(a.str() == b.str());
+      if (const NextMove* next = std::get_if<NextMove>(&move))
+      {
+        const NextMove& other = std::get<NextMove>(unpacked);
+        assert(next->src == other.src && next->dst == other.dst && next->piece == other.piece);
+        assert(next->capture == other.capture && next->check == other.check);
+        assert(next->checkmate == other.checkmate && next->promote_piece == other.promote_piece);
+        assert(next->is_white_move == other.is_white_move);
+      }
+    }
+  }
+
+  // the board tells the squares it resolved a move to
+  ChessBoard board;
+  std::vector<PackedMove> played;
+  std::vector<PackedSan> moves;
+  bool white = true;
+  for (const char* san : {"e4", "d5", "exd5", "Nf6", "Nf3", "Nxd5", "Bc4", "e6", "O-O", "Be7"})
+  {
+    moves.push_back(pack(MoveFactory()(san, white)));
+    white = !white;
+  }
+  const bool replayed = replay_packed(moves, board, played);
+  assert(replayed);
+  std::ostringstream uci;
+  for (PackedMove move : played)
+    uci << move << (move.castling() ? "c " : " ");
+  assert(uci.str() == "e2e4 d7d5 e4d5 g8f6 g1f3 f6d5 f1c4 e7e6 e1g1c f8e7 ");
+  assert(PackedMove(8, 0, 'Q').promotion() == 'Q');
+  std::ostringstream promotion;
+  promotion << PackedMove(8, 0, 'N');
+  assert(promotion.str() == "a7a8n");
+
+  // a move which can not be played stops the replay with the moves before it kept
+  moves.push_back(pack(MoveFactory()("Ke5", true)));
+  ChessBoard again;
+  played.clear();
+  const bool stopped = !replay_packed(moves, again, played);
+  assert(stopped && played.size() == 10);
+
+  // games parsed into flat arrays and played later give the same positions as replay_games
+  const std::string pgn = mixed_games_pgn(100);
+  std::vector<std::string> expected;
+  TokenScanner replay_scanner(pgn);
+  replay_games(replay_scanner, 0, [&](const GameRecord& record, const ChessBoard& position)
+               {
+                 std::ostringstream o;
+                 o << record.offset << " " << record.plies << "\n" << position;
+                 expected.push_back(o.str());
+               });
+  std::vector<std::string> packed;
+  TokenScanner scanner(pgn);
+  read_packed_games(scanner, 0, [&](const GameRecord& record, std::span<const PackedSan> game)
+                    {
+                      assert(game.size() == record.plies);
+                      ChessBoard position;
+                      played.clear();
+                      const bool ok = replay_packed(game, position, played);
+                      assert(ok && played.size() == game.size());
+                      std::ostringstream o;
+                      o << record.offset << " " << record.plies << "\n" << position;
+                      packed.push_back(o.str());
+                    });
+  assert(packed == expected);
+
+  // replay_games hands out the packed moves it played, and the board plays a packed move the
+  // same as the decoded one
+  TokenScanner moves_scanner(pgn);
+  size_t games = 0;
+  replay_games(moves_scanner, 0,
+               [&](const GameRecord& record, const ChessBoard& position,
+                   std::span<const PackedSan> game)
+               {
+                 assert(game.size() == record.plies);
+                 ChessBoard from_packed, from_decoded;
+                 std::vector<PackedMove> packed_squares, decoded_squares;
+                 for (PackedSan move : game)
+                 {
+                   const bool packed_ok =
+                     from_packed.try_apply(move, &packed_squares.emplace_back());
+                   const bool decoded_ok =
+                     from_decoded.try_apply(unpack(move), &decoded_squares.emplace_back());
+                   assert(packed_ok && decoded_ok);
+                 }
+                 assert(packed_squares == decoded_squares);
+                 std::ostringstream a, b, c;
+                 a << position;
+                 b << from_packed;
+                 c << from_decoded;
+                 assert(a.str() == b.str() && b.str() == c.str());
+                 ++games;
+               });
+  assert(games == expected.size());
+}
+
+void test_san_cache()
+{
+  // the cache gives what MoveFactory decodes for either side, whether the token is cached or not
+  const std::vector<std::string> sans = {"e", "h1", "e4", "e44", "Nf3", "O-O", "1-0", "Bxe5",
+                                         "Bxe5+", "O-O-O", "a7xb8=Q", "1/2-1/2", "Nb8xd7=Q",
+                                         "Nb8xd7=Q+", "R1e2", "Re12", "Kxd1"};
+  CachingMoveFactory cache;
+  for (int pass = 0; pass < 3; ++pass)
+  {
+    for (const std::string& san : sans)
+    {
+      for (bool white : {true, false})
+      {
+        const PackedSan packed = cache(san, white);
+        assert(packed == pack(MoveFactory()(san, white)));
+        std::ostringstream a, b;
+        a << MoveFactory()(san, white);
+        b << unpack(cache(san, white));
+        assert(a.str() == b.str());
+      }
+    }
+  }
+  // every token of up to 8 bytes is found in the table after its first time, longer are not
+  assert(cache.lookups() == 3 * 2 * 2 * sans.size());
+  assert(cache.hits() == cache.lookups() - (sans.size() - 1) - 3 * 2 * 2);
+
+  // a symbol which is no move is decoded again every time and reported each time
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    std::string error;
+    cache("Zz4", true, &error);
+    assert(error.find("Zz4") != std::string::npos);
+  }
+  bool thrown = false;
+  try
+  {
+    cache("Zz4", false);
+  }
+  catch (const std::runtime_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+
+  // bytes out of ASCII bypass the table
+  const uint64_t hits = cache.hits();
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    std::string error;
+    cache("N\xc3\xa9", true, &error);
+    assert(!error.empty());
+  }
+  assert(cache.hits() == hits);
+
+  // a lenient parser reports the symbol through the cache as well
+  BasicPGNParser<CachingMoveFactory> parser;
+  parser.set_lenient();
+  TokenScanner scanner(std::string_view("1. e4 e5 2. Zz4 1-0"));
+  size_t moves = 0;
+  for (const auto& token : scanner)
+  {
+    if (parser.failed())
+      break;
+    if (auto action = parser.consume_token(token, scanner.text(token)))
+      moves += action->index() == index_of<NextMove>;
+  }
+  assert(moves == 2 && parser.failed());
+
+  // replay_games and the parallel replay look every SAN up in the cache they are given
+  const std::string pgn = mixed_games_pgn(20);
+  CachingMoveFactory sequential;
+  TokenScanner games_scanner(pgn);
+  NoEvents none;
+  uint64_t plies = 0;
+  replay_games(
+    games_scanner, 0, [&](const GameRecord& record, const ChessBoard&) { plies += record.plies; },
+    none, &sequential);
+  assert(plies > 0 && sequential.lookups() >= plies && sequential.hits() > 0);
+  CachingMoveFactory parallel;
+  replay_games_parallel(
+    pgn.data(), pgn.data() + pgn.size(), 3,
+    [](const GameRecord& record, const ChessBoard&) { return record.plies; }, nullptr, &parallel);
+  assert(parallel.lookups() == sequential.lookups() && parallel.hits() > 0);
+}
+
+void test_long_moves()
+{
+  // UCI and long algebraic moves name both squares, captures included
+  const MoveFactory decode;
+  const LongMove uci = std::get<LongMove>(decode("e2e4", true));
+  assert(uci.from == r('2') * 8 + f('e') && uci.to == r('4') * 8 + f('e'));
+  assert(uci.piece == '\0' && uci.promote_piece == '\0' && uci.is_white_move);
+  assert(std::get<LongMove>(decode("e2e1q", false)).promote_piece == 'Q');
+  assert(std::get<LongMove>(decode("b7-b8=N+", true)).promote_piece == 'N');
+  const LongMove lan = std::get<LongMove>(decode("Ng8-f6", false));
+  assert(lan.piece == 'N' && lan.to == r('6') * 8 + f('f') && !lan.is_white_move);
+  const LongMove capture = std::get<LongMove>(decode("a7xb8=Q", true));
+  assert(capture.capture && capture.promote_piece == 'Q' && capture.to == r('8') * 8 + f('b'));
+  assert(std::get<LongMove>(decode("Ng1xf3+", true)).capture);
+  assert(!std::get<LongMove>(decode("Ng1-f3", true)).capture);
+  for (const char* san : {"Nf3", "Nf3+", "R1e2", "exd5", "Nbd7", "e8=Q", "Qh4xe1"})
+    assert(std::holds_alternative<NextMove>(decode(san, true)) == (san[0] != 'Q'));
+  std::string error;
+  decode("e2e4k", true, &error);
+  assert(!error.empty());
+  for (const char* move : {"e2e4", "a7a8n", "Ng1-f3"})
+  {
+    const Moves long_move = decode(move, false);
+    assert(pack(unpack(pack(long_move))) == pack(long_move));
+    std::ostringstream a, b;
+    a << long_move;
+    b << unpack(pack(long_move));
+    assert(a.str() == b.str());
+  }
+
+  // the same games as SAN and as UCI end on the same boards: en passant, promotion and castling,
+  // written the UCI way and by the king taking its rook
+  const std::vector<std::pair<std::string, std::string>> games{
+    {"1. e4 d5 2. exd5 Nf6 3. Nf3 Nxd5 4. Bc4 e6 5. O-O Be7 *",
+     "1. e2e4 d7d5 2. e4d5 g8f6 3. g1f3 f6d5 4. f1c4 e7e6 5. e1g1 f8e7 *"},
+    {"1. e4 a6 2. e5 d5 3. exd6 Qxd6 4. d4 Bd7 5. Nc3 Nc6 6. Be3 O-O-O *",
+     "1. e2-e4 a7-a6 2. e4-e5 d7-d5 3. e5xd6 Qd8xd6 4. d2d4 c8d7 5. b1c3 b8c6 6. c1e3 e8a8 *"},
+    {"1. h4 g5 2. hxg5 h6 3. gxh6 Nc6 4. h7 Nd4 5. hxg8=Q Nxc2+ *",
+     "1. h2h4 g7g5 2. h4g5 h7h6 3. g5h6 b8c6 4. h6h7 c6d4 5. h7g8q d4c2 *"},
+    {"1. e4 e5 2. Nf3 Nc6 3. Bc4 Nf6 4. O-O Bc5 *",
+     "1. e2e4 e7e5 2. g1f3 b8c6 3. f1c4 g8f6 4. e1h1 f8c5 *"}};
+  for (const auto& [san, long_moves] : games)
+    assert(board_after(san) == board_after(long_moves));
+
+  // the board tells a castling by the squares of the king however it was written
+  ChessBoard board;
+  std::vector<PackedMove> played;
+  std::vector<PackedSan> moves;
+  for (const char* move : {"e2e4", "e7e5", "g1f3", "b8c6", "f1c4", "g8f6", "e1h1"})
+    moves.push_back(pack(decode(move, moves.size() % 2 == 0)));
+  const bool castled = replay_packed(moves, board, played);
+  assert(castled && played.size() == moves.size());
+  std::ostringstream printed;
+  printed << played.back();
+  assert(played.back().castling() && printed.str() == "e1g1");
+
+  // a move the position does not allow is not played
+  for (const char* move : {"e2e5", "e7e5", "d1d3", "g1g3", "e1g1", "Bb1-c3", "e2e4q", "e2xe4"})
+  {
+    ChessBoard fresh;
+    const bool applied = fresh.try_apply(decode(move, true));
+    assert(!applied);
+  }
+  TokenScanner scanner(std::string_view("[Event \"x\"]\n\n1. e2e4 e7e5 2. e1e3 b8c6 1-0\n\n"));
+  std::string reason;
+  replay_games_lenient(scanner, 0, [](const GameRecord&, const ChessBoard&) { assert(false); },
+                       [&](const RejectedGame& game) { reason = game.reason; });
+  assert(reason.find("[e1e3]") != std::string::npos);
+}
+
 int main()
 {
   test_move_parser();
+  test_special_symbols();
   test_king_move();
   test_bishop_move();
   test_knight_move();
@@ -1301,6 +2801,24 @@ int main()
   test_pawn_en_passant_board_moves();
   test_locked_moves();
   test_rav();
+  test_scanner_range_input();
+  test_scan_kernels();
+  test_compact_tokens();
+  test_read_ahead();
+  test_decompression();
+  test_parallel_replay();
+  test_game_index();
+  test_headers();
+  test_tag_projection();
+  test_pgn_events();
+  test_pgn_games();
+  test_move_tree();
+  test_annotations();
+  test_commands();
+  test_lenient_replay();
+  test_packed_moves();
+  test_san_cache();
+  test_long_moves();
   integration_tests();
   return 0;
 }
@@ -17,292 +17,108 @@
 #pragma once
 
 #include "common.h"
-#include <cctype>
+#include <array>
+#include <cstdint>
 #include <ostream>
-#include <type_traits>
-#include <typeindex>
-#include <typeinfo>
-#include <variant>
-#include <vector>
-
-enum class AcceptResult
-{
-  CONSUMED,
-  TERMINATED_CONSUMED,
-  TERMINATED_NONCONSUMED,
-  INVALID
-};
-
-template <class T>
-concept token = requires(T t)
-{
-  {
-    t.accept('a')
-    } -> std::same_as<AcceptResult>;
-};
-
-struct StringToken
-{
-  static constexpr char name[] = "StringToken";
-  static std::type_index Event;
-
-  std::string value_;
-  AcceptResult accept(char c)
-  {
-    if (c == '\"')
-    {
-      if (value_.empty())
-      {
-        // no need to store quotes in our string!
-        return AcceptResult::CONSUMED;
-      }
-      else if (value_.back() == '\\')
-      {
-        // so this is not really terminate character, but just another char
-        value_.pop_back(); // remove previous escaped char
-        value_.push_back(c);
-        return AcceptResult::CONSUMED;
-      }
-      else
-      {
-        return AcceptResult::TERMINATED_CONSUMED;
-      }
-    }
-    else if (c == '\\')
-    {
-      // TODO: TEST sequences of backslashes!
-      if (value_.empty() || value_.back() == '\\')
-        value_.push_back(c);
-
-      return AcceptResult::CONSUMED;
-    }
-    else if (std::isprint(c))
-    {
-      if (!value_.empty() && value_.back() == '\\')
-      {
-        // backslash is not printed so this input is invalid!
-        return AcceptResult::INVALID;
-      }
-
-      value_.push_back(c);
-      return AcceptResult::CONSUMED;
-    }
-    else
-    {
-      return AcceptResult::INVALID;
-    }
-  }
-};
-
-struct PeriodToken
-{
-  static constexpr char name[] = "PeriodToken";
-  static std::type_index Event;
-
-  AcceptResult accept(char c)
-  {
-    if (c == '.')
-    {
-      return AcceptResult::TERMINATED_CONSUMED;
-    }
-    else
-    {
-      return AcceptResult::TERMINATED_NONCONSUMED;
-    }
-  }
-};
-
-struct AsterkixToken
-{
-  static std::type_index Event;
-  static constexpr char name[] = "AsterixToken";
-  AcceptResult accept(char c) { return AcceptResult::TERMINATED_CONSUMED; }
-};
-
-struct LeftBraceToken
-{
-  static std::type_index Event;
-  static constexpr char name[] = "LeftBraceToken";
-  AcceptResult accept(char c) { return AcceptResult::TERMINATED_CONSUMED; }
-};
-
-struct RightBraceToken
-{
-  static std::type_index Event;
-  static constexpr char name[] = "RightBraceToken";
-  AcceptResult accept(char c) { return AcceptResult::TERMINATED_CONSUMED; }
-};
-
-struct LeftParenthesisToken
-{
-  static std::type_index Event;
-  static constexpr char name[] = "LeftParenthesisToken";
-  AcceptResult accept(char c) { return AcceptResult::TERMINATED_CONSUMED; }
-};
-
-struct RightParenthesisToken
-{
-  static std::type_index Event;
-  static constexpr char name[] = "RightParenthesisToken";
-  AcceptResult accept(char c) { return AcceptResult::TERMINATED_CONSUMED; }
-};
-
-struct NumericAnnotationToken
-{
-  static std::type_index Event;
-  static constexpr char name[] = "NumericAnnotationToken";
-  AcceptResult accept(char c) { return AcceptResult::TERMINATED_CONSUMED; }
-};
-
-struct BraceComment
-{
-  static std::type_index Event;
-  static constexpr char name[] = "BraceComment";
-
-  AcceptResult accept(char c)
-  {
-    // we just skip comments
-    if (c == '}')
-    {
-      return AcceptResult::TERMINATED_CONSUMED;
-    }
-    else
-    {
-      return AcceptResult::CONSUMED;
-    }
-  }
-};
+#include <string>
+#include <string_view>
+
+enum class TokenKind : uint8_t
+{
+  None,
+  String,
+  Period,
+  Asterisk,
+  LeftBrace,
+  RightBrace,
+  LeftParenthesis,
+  RightParenthesis,
+  NumericAnnotation,
+  Symbol,
+  Integer,
+  BraceComment,
+  LineComment,
+  Escape,
+  NumericGlyph,
+  Invalid, // bytes of a malformed token, only from a lenient scanner
+  Count
+};
+
+inline constexpr size_t TOKEN_KIND_COUNT = static_cast<size_t>(TokenKind::Count);
+
+inline constexpr std::array<const char*, TOKEN_KIND_COUNT> token_kind_names{
+  "null",
+  "StringToken",
+  "PeriodToken",
+  "AsterixToken",
+  "LeftBraceToken",
+  "RightBraceToken",
+  "LeftParenthesisToken",
+  "RightParenthesisToken",
+  "NumericAnnotationToken",
+  "SymbolToken",
+  "IntegerToken",
+  "BraceComment",
+  "LineComment",
+  "EscapeToken",
+  "NumericGlyphToken",
+  "InvalidToken"};
+
+inline const char* token_kind_name(TokenKind kind)
+{
+  return token_kind_names[static_cast<size_t>(kind)];
+}
 
-struct LineComment
+// A token is only a reference into the input: the scanner resolves [offset, offset + length) to
+// its text on request, so scanning never allocates and tokens could be kept in flat arrays.
+struct Token
 {
-  static std::type_index Event;
-  static constexpr char name[] = "LineComment";
-
-  AcceptResult accept(char c)
+  enum Flags : uint8_t
   {
-    // we just skip comments
-    if (c == '\n')
-    {
-      return AcceptResult::TERMINATED_CONSUMED;
-    }
-    else
-    {
-      return AcceptResult::CONSUMED;
-    }
-  }
-};
+    ESCAPED = 1 << 0, // string contains escape sequences, see unescape()
+  };
 
-struct EscapeToken
-{
-  static std::type_index Event;
-  static constexpr char name[] = "EscapeToken";
-
-  AcceptResult accept(char c)
-  {
-    // we just skip comments
-    if (c == '\n')
-    {
-      return AcceptResult::TERMINATED_CONSUMED;
-    }
-    else
-    {
-      return AcceptResult::CONSUMED;
-    }
-  }
+  uint64_t offset = 0; // absolute position in the input
+  uint32_t length = 0; // strings exclude both quotes
+  TokenKind kind = TokenKind::None;
+  uint8_t flags = 0;
+  uint16_t number = 0; // value of an IntegerToken or of a NAG, saturated
 };
 
-struct NumericGlyphToken
-{
-  static std::type_index Event;
-  static constexpr char name[] = "NumericGlyphToken";
-  bool first = true;
-
-  AcceptResult accept(char c)
-  {
-    // we just skip comments
-    if (std::isdigit(c) || (first && c == '$'))
-    {
-      first = false;
-      return AcceptResult::CONSUMED;
-    }
-    else
-    {
-      return AcceptResult::TERMINATED_NONCONSUMED;
-    }
-  }
-};
+static_assert(sizeof(Token) == 16);
 
-struct SymbolToken
+// resolves escape sequences of a string token; the result is a view of `text` when there are none
+inline std::string_view unescape(const Token& token, std::string_view text, std::string& scratch)
 {
-  static std::type_index Event;
-  static constexpr char name[] = "SymbolToken";
-
-  std::string value_;
-  bool number_only_ = true;
+  if (!(token.flags & Token::ESCAPED))
+    return text;
 
-  static bool is_symbol_char(char c)
+  scratch.clear();
+  for (size_t i = 0; i < text.size(); ++i)
   {
-    return std::isdigit(c) || std::isalpha(c) || c == ':' || c == '-' || c == '_' || c == '+' ||
-      c == '=' || c == '#' || c == '/';
-  }
-
-  AcceptResult accept(char c)
-  {
-    if (is_symbol_char(c))
-    {
-      if (!std::isdigit(c))
-        number_only_ = false;
-
-      value_.push_back(c);
-      return AcceptResult::CONSUMED;
-    }
-    else
-    {
-      return AcceptResult::TERMINATED_NONCONSUMED;
-    }
+    if (text[i] == '\\')
+      ++i;
+    scratch.push_back(text[i]);
   }
-};
+  return scratch;
+}
 
-struct IntegerToken
+// text of a brace or a line comment without its delimiters
+inline std::string_view comment_text(const Token& token, std::string_view text)
 {
-  static std::type_index Event;
-  static constexpr char name[] = "IntegerToken";
-
-  std::string value_;
-  AcceptResult accept(char c)
+  if (token.kind == TokenKind::BraceComment && text.size() >= 2)
+    return text.substr(1, text.size() - 2);
+  if (token.kind == TokenKind::LineComment && !text.empty())
   {
-    throw std::runtime_error("IntegerToken::accept is not meant to be called");
+    text.remove_prefix(1);
+    while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+      text.remove_suffix(1);
   }
-};
-
-using Token =
-  std::variant<std::monostate, StringToken, PeriodToken, AsterkixToken, LeftBraceToken, RightBraceToken, LeftParenthesisToken, RightParenthesisToken,
-               NumericAnnotationToken, SymbolToken, IntegerToken, BraceComment, LineComment, EscapeToken, NumericGlyphToken>;
-
-inline std::ostream& operator<<(std::ostream& o, const token auto& t)
-{
-  using token_type = std::decay_t<decltype(t)>;
-  o << "[" << token_type::name << "],";
-  return o;
+  return text;
 }
 
-inline std::ostream& operator<<(std::ostream& o, const std::monostate& null)
+inline std::ostream& operator<<(std::ostream& o, const Token& t)
 {
-  o << "[null]";
+  o << "[" << token_kind_name(t.kind) << "],";
   return o;
 }
-
-inline std::type_index StringToken::Event = typeid(StringToken);
-inline std::type_index PeriodToken::Event = typeid(PeriodToken);
-inline std::type_index AsterkixToken::Event = typeid(AsterkixToken);
-inline std::type_index LeftBraceToken::Event = typeid(LeftBraceToken);
-inline std::type_index RightBraceToken::Event = typeid(RightBraceToken);
-inline std::type_index LeftParenthesisToken::Event = typeid(LeftParenthesisToken);
-inline std::type_index RightParenthesisToken::Event = typeid(RightParenthesisToken);
-inline std::type_index NumericAnnotationToken::Event = typeid(NumericAnnotationToken);
-inline std::type_index SymbolToken::Event = typeid(SymbolToken);
-inline std::type_index IntegerToken::Event = typeid(IntegerToken);
-inline std::type_index BraceComment::Event = typeid(BraceComment);
-inline std::type_index LineComment::Event = typeid(LineComment);
-inline std::type_index EscapeToken::Event = typeid(EscapeToken);
-inline std::type_index NumericGlyphToken::Event = typeid(NumericGlyphToken);